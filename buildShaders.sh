@@ -3,6 +3,7 @@
 shaderfiles=(
     "triangle.frag"
     "triangle.vert"
+    "triangle_compact.vert"
 )
 
 shaderpath="shaders"
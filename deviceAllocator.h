@@ -0,0 +1,635 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+
+// Sub-allocates buffers and images from large VkDeviceMemory blocks, one set of blocks per memory type.
+// Every block is managed by a two level segregated fit (TLSF) allocator over byte offsets: free ranges are
+// kept in lists by size class, so finding and merging ranges takes constant time apart from alignment.
+// Host visible blocks stay mapped for their whole lifetime, since a memory object can only be mapped once.
+
+// Ranges of linear resources (buffers, linear images) and optimal images must not share a
+// bufferImageGranularity page
+enum class ResourceKind : uint8_t
+{
+    Free,
+    Linear,
+    Optimal,
+};
+
+namespace deviceAllocatorDetail
+{
+    const uint32_t     SECOND_LEVEL_BITS  = 4;
+    const uint32_t     SECOND_LEVEL_COUNT = 1u << SECOND_LEVEL_BITS;
+    const uint32_t     FIRST_LEVEL_COUNT  = 64;
+    const VkDeviceSize SMALL_SIZE         = 256; // sizes below share the first list row, in 16 byte steps
+    const uint32_t     NO_NODE            = ~0u;
+
+    inline uint32_t highestBit(uint64_t value)
+    {
+        uint32_t bit = 0;
+        while (value >>= 1)
+        {
+            bit++;
+        }
+        return bit;
+    }
+
+    inline uint32_t lowestBit(uint64_t value)
+    {
+        uint32_t bit = 0;
+        while (!(value & 1))
+        {
+            value >>= 1;
+            bit++;
+        }
+        return bit;
+    }
+
+    // List of a free range of the given size, every range in list (first, second) is at least as large as
+    // the smallest size mapping there
+    inline void mapSize(VkDeviceSize size, uint32_t& first, uint32_t& second)
+    {
+        if (size < SMALL_SIZE)
+        {
+            first  = 0;
+            second = static_cast<uint32_t>(size / (SMALL_SIZE / SECOND_LEVEL_COUNT));
+            return;
+        }
+        const uint32_t bit = highestBit(size);
+        first  = bit - highestBit(SMALL_SIZE) + 1;
+        second = static_cast<uint32_t>((size >> (bit - SECOND_LEVEL_BITS)) & (SECOND_LEVEL_COUNT - 1));
+    }
+
+    inline VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}
+
+// TLSF allocator over the offsets [0, size) of one block
+class TlsfBlock
+{
+public:
+    TlsfBlock(VkDeviceSize size, VkDeviceSize granularity)
+        : granularity(granularity)
+    {
+        Node node;
+        node.size = size;
+        nodes.push_back(node);
+        insertFree(0);
+    }
+
+    // Returns the node of the allocation or NO_NODE. The offset honours alignment and keeps resources of the
+    // other kind off the granularity pages at both ends.
+    uint32_t allocate(VkDeviceSize size, VkDeviceSize alignment, ResourceKind kind, VkDeviceSize& offset)
+    {
+        using namespace deviceAllocatorDetail;
+
+        uint32_t first, second;
+        mapSize(size, first, second);
+
+        // Ranges in the lists from (first, second) on are mostly large enough, the first one that fits wins
+        uint32_t secondMask = secondBitmaps[first] & (~0u << second);
+        uint64_t firstMask  = firstBitmap & (first + 1 < 64 ? ~0ull << (first + 1) : 0);
+        while (secondMask || firstMask)
+        {
+            if (!secondMask)
+            {
+                first      = lowestBit(firstMask);
+                firstMask &= firstMask - 1;
+                secondMask = secondBitmaps[first];
+            }
+            second      = lowestBit(secondMask);
+            secondMask &= secondMask - 1;
+
+            for (uint32_t index = heads[first][second]; index != NO_NODE; index = nodes[index].nextFree)
+            {
+                if (fits(index, size, alignment, kind, offset))
+                {
+                    return split(index, offset, size, kind);
+                }
+            }
+        }
+        return NO_NODE;
+    }
+
+    void free(uint32_t index)
+    {
+        using namespace deviceAllocatorDetail;
+
+        usedBytes -= nodes[index].size;
+        allocations--;
+        nodes[index].kind = ResourceKind::Free;
+
+        const uint32_t next = nodes[index].nextPhysical;
+        if (next != NO_NODE && nodes[next].kind == ResourceKind::Free)
+        {
+            removeFree(next);
+            merge(index, next);
+        }
+        const uint32_t previous = nodes[index].previousPhysical;
+        if (previous != NO_NODE && nodes[previous].kind == ResourceKind::Free)
+        {
+            removeFree(previous);
+            merge(previous, index);
+            index = previous;
+        }
+        insertFree(index);
+    }
+
+    VkDeviceSize used() const
+    {
+        return usedBytes;
+    }
+
+    uint32_t allocationCount() const
+    {
+        return allocations;
+    }
+
+    // Free ranges in physical order
+    template<typename Visit>
+    void forEachFreeRange(const Visit& visit) const
+    {
+        for (uint32_t index = 0; index != deviceAllocatorDetail::NO_NODE; index = nodes[index].nextPhysical)
+        {
+            if (nodes[index].kind == ResourceKind::Free)
+            {
+                visit(nodes[index].size);
+            }
+        }
+    }
+
+private:
+    struct Node
+    {
+        VkDeviceSize offset           = 0;
+        VkDeviceSize size             = 0;
+        ResourceKind kind             = ResourceKind::Free;
+        uint32_t     previousPhysical = deviceAllocatorDetail::NO_NODE;
+        uint32_t     nextPhysical     = deviceAllocatorDetail::NO_NODE;
+        uint32_t     previousFree     = deviceAllocatorDetail::NO_NODE;
+        uint32_t     nextFree         = deviceAllocatorDetail::NO_NODE;
+    };
+
+    static bool conflicts(ResourceKind a, ResourceKind b)
+    {
+        return a != ResourceKind::Free && b != ResourceKind::Free && a != b;
+    }
+
+    bool fits(uint32_t index, VkDeviceSize size, VkDeviceSize alignment, ResourceKind kind, VkDeviceSize& offset) const
+    {
+        using namespace deviceAllocatorDetail;
+
+        const Node& node = nodes[index];
+        offset           = alignUp(node.offset, alignment);
+
+        const uint32_t previous = node.previousPhysical;
+        if (previous != NO_NODE && conflicts(nodes[previous].kind, kind)
+            && (nodes[previous].offset + nodes[previous].size - 1) / granularity == offset / granularity)
+        {
+            offset = alignUp(offset, std::max(alignment, granularity));
+        }
+        if (offset + size > node.offset + node.size)
+        {
+            return false;
+        }
+
+        const uint32_t next = node.nextPhysical;
+        return next == NO_NODE || !conflicts(nodes[next].kind, kind) || (offset + size - 1) / granularity != nodes[next].offset / granularity;
+    }
+
+    // Turns [offset, offset + size) of the free node into an allocation, with free nodes for what is left around it
+    uint32_t split(uint32_t index, VkDeviceSize offset, VkDeviceSize size, ResourceKind kind)
+    {
+        removeFree(index);
+
+        if (offset > nodes[index].offset)
+        {
+            const uint32_t front = index;
+            index = insertAfter(front, offset, nodes[front].offset + nodes[front].size - offset);
+            nodes[front].size = offset - nodes[front].offset;
+            insertFree(front);
+        }
+        if (nodes[index].size > size)
+        {
+            const uint32_t back = insertAfter(index, offset + size, nodes[index].size - size);
+            nodes[index].size   = size;
+            insertFree(back);
+        }
+
+        nodes[index].kind = kind;
+        usedBytes        += size;
+        allocations++;
+        return index;
+    }
+
+    uint32_t insertAfter(uint32_t index, VkDeviceSize offset, VkDeviceSize size)
+    {
+        uint32_t created;
+        if (!unusedNodes.empty())
+        {
+            created = unusedNodes.back();
+            unusedNodes.pop_back();
+        }
+        else
+        {
+            created = static_cast<uint32_t>(nodes.size());
+            nodes.emplace_back();
+        }
+
+        Node& node            = nodes[created];
+        node                  = Node();
+        node.offset           = offset;
+        node.size             = size;
+        node.previousPhysical = index;
+        node.nextPhysical     = nodes[index].nextPhysical;
+        if (node.nextPhysical != deviceAllocatorDetail::NO_NODE)
+        {
+            nodes[node.nextPhysical].previousPhysical = created;
+        }
+        nodes[index].nextPhysical = created;
+        return created;
+    }
+
+    // Appends next to index, next is a physical neighbour that disappears
+    void merge(uint32_t index, uint32_t next)
+    {
+        nodes[index].size        += nodes[next].size;
+        nodes[index].nextPhysical = nodes[next].nextPhysical;
+        if (nodes[index].nextPhysical != deviceAllocatorDetail::NO_NODE)
+        {
+            nodes[nodes[index].nextPhysical].previousPhysical = index;
+        }
+        unusedNodes.push_back(next);
+    }
+
+    void insertFree(uint32_t index)
+    {
+        uint32_t first, second;
+        deviceAllocatorDetail::mapSize(nodes[index].size, first, second);
+
+        Node& node        = nodes[index];
+        node.kind         = ResourceKind::Free;
+        node.previousFree = deviceAllocatorDetail::NO_NODE;
+        node.nextFree     = heads[first][second];
+        if (node.nextFree != deviceAllocatorDetail::NO_NODE)
+        {
+            nodes[node.nextFree].previousFree = index;
+        }
+        heads[first][second]  = index;
+        firstBitmap          |= 1ull << first;
+        secondBitmaps[first] |= 1u << second;
+    }
+
+    void removeFree(uint32_t index)
+    {
+        uint32_t first, second;
+        deviceAllocatorDetail::mapSize(nodes[index].size, first, second);
+
+        const Node& node = nodes[index];
+        if (node.previousFree != deviceAllocatorDetail::NO_NODE)
+        {
+            nodes[node.previousFree].nextFree = node.nextFree;
+        }
+        else
+        {
+            heads[first][second] = node.nextFree;
+        }
+        if (node.nextFree != deviceAllocatorDetail::NO_NODE)
+        {
+            nodes[node.nextFree].previousFree = node.previousFree;
+        }
+
+        if (heads[first][second] == deviceAllocatorDetail::NO_NODE)
+        {
+            secondBitmaps[first] &= ~(1u << second);
+            if (!secondBitmaps[first])
+            {
+                firstBitmap &= ~(1ull << first);
+            }
+        }
+    }
+
+    using ListHeads = std::array<uint32_t, deviceAllocatorDetail::SECOND_LEVEL_COUNT>;
+
+    VkDeviceSize          granularity;
+    VkDeviceSize          usedBytes   = 0;
+    uint32_t              allocations = 0;
+    std::vector<Node>     nodes;       // node 0 always starts at offset 0, the physical list begins there
+    std::vector<uint32_t> unusedNodes;
+    uint64_t              firstBitmap = 0;
+    std::array<uint32_t, deviceAllocatorDetail::FIRST_LEVEL_COUNT>  secondBitmaps = {};
+    std::array<ListHeads, deviceAllocatorDetail::FIRST_LEVEL_COUNT> heads         = filledHeads();
+
+    static std::array<ListHeads, deviceAllocatorDetail::FIRST_LEVEL_COUNT> filledHeads()
+    {
+        std::array<ListHeads, deviceAllocatorDetail::FIRST_LEVEL_COUNT> lists;
+        for (ListHeads& list : lists)
+        {
+            list.fill(deviceAllocatorDetail::NO_NODE);
+        }
+        return lists;
+    }
+};
+
+struct MemoryBlock
+{
+    VkDeviceMemory memory     = VK_NULL_HANDLE;
+    VkDeviceSize   size       = 0;
+    uint32_t       memoryType = 0;
+    void*          mapped     = nullptr;
+    TlsfBlock      allocator;
+
+    MemoryBlock(VkDeviceSize size, VkDeviceSize granularity)
+        : size(size)
+        , allocator(size, granularity)
+    {
+    }
+};
+
+// A range of device memory backing one resource. block is null for dedicated allocations.
+struct DeviceAllocation
+{
+    VkDeviceMemory memory     = VK_NULL_HANDLE;
+    VkDeviceSize   offset     = 0;
+    VkDeviceSize   size       = 0;
+    void*          mapped     = nullptr; // start of the range for host visible memory
+    MemoryBlock*   block      = nullptr;
+    uint32_t       node       = 0;
+    uint32_t       memoryType = 0;
+};
+
+struct DeviceAllocatorStats
+{
+    uint32_t     blockCount        = 0;
+    VkDeviceSize blockBytes        = 0;
+    uint32_t     dedicatedCount    = 0;
+    VkDeviceSize dedicatedBytes    = 0;
+    uint32_t     allocationCount   = 0; // in blocks
+    VkDeviceSize usedBytes         = 0; // in blocks
+    uint32_t     freeRangeCount    = 0;
+    VkDeviceSize largestFreeRange  = 0;
+    float        fragmentation     = 0.0f; // 1 - largest free range / free bytes, 0 while free memory is contiguous
+};
+
+class DeviceAllocator
+{
+public:
+    DeviceAllocator(VkPhysicalDevice physicalDevice, VkDevice device)
+        : device(device)
+    {
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        granularity         = std::max<VkDeviceSize>(1, properties.limits.bufferImageGranularity);
+        nonCoherentAtomSize = std::max<VkDeviceSize>(1, properties.limits.nonCoherentAtomSize);
+        maxAllocationCount  = properties.limits.maxMemoryAllocationCount;
+        blocks.resize(memoryProperties.memoryTypeCount);
+    }
+
+    ~DeviceAllocator()
+    {
+        for (auto& typeBlocks : blocks)
+        {
+            for (auto& block : typeBlocks)
+            {
+                vkFreeMemory(device, block->memory, nullptr);
+            }
+        }
+    }
+
+    DeviceAllocator(const DeviceAllocator&)            = delete;
+    DeviceAllocator& operator=(const DeviceAllocator&) = delete;
+
+    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const
+    {
+        for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+        {
+            if (typeFilter & (1 << i) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+            {
+                return i;
+            }
+        }
+
+        throw std::runtime_error("failed to find suitable memory type!");
+    }
+
+    bool hasMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const
+    {
+        for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+        {
+            if (typeFilter & (1 << i) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    VkMemoryPropertyFlags propertyFlags(const DeviceAllocation& allocation) const
+    {
+        return memoryProperties.memoryTypes[allocation.memoryType].propertyFlags;
+    }
+
+    // Large images get memory of their own, they would mostly waste the rest of a block. So do lazily allocated
+    // attachments, which the driver only commits per memory object.
+    DeviceAllocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, ResourceKind kind)
+    {
+        const uint32_t     memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+        const VkDeviceSize blockSize  = preferredBlockSize(memoryType);
+        const bool         lazy       = (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0;
+        const bool         dedicated  = lazy || requirements.size > blockSize / 2 || (kind == ResourceKind::Optimal && requirements.size >= blockSize / 4);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (dedicated)
+        {
+            DeviceAllocation allocation;
+            allocation.size       = requirements.size;
+            allocation.memoryType = memoryType;
+            allocation.memory     = allocateMemory(requirements.size, memoryType, allocation.mapped);
+            dedicatedCount++;
+            dedicatedBytes += requirements.size;
+            return allocation;
+        }
+
+        for (auto& block : blocks[memoryType])
+        {
+            DeviceAllocation allocation;
+            if (allocateFromBlock(*block, requirements, kind, allocation))
+            {
+                return allocation;
+            }
+        }
+
+        auto block        = std::make_unique<MemoryBlock>(blockSize, granularity);
+        block->memoryType = memoryType;
+        block->memory     = allocateMemory(blockSize, memoryType, block->mapped);
+        blocks[memoryType].push_back(std::move(block));
+
+        DeviceAllocation allocation;
+        if (!allocateFromBlock(*blocks[memoryType].back(), requirements, kind, allocation))
+        {
+            throw std::runtime_error("failed to sub-allocate device memory!");
+        }
+        return allocation;
+    }
+
+    // Empty blocks are released, except for the last one of a memory type, which absorbs the staging churn
+    void free(DeviceAllocation& allocation)
+    {
+        if (allocation.memory == VK_NULL_HANDLE)
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!allocation.block)
+        {
+            vkFreeMemory(device, allocation.memory, nullptr);
+            memoryObjectCount--;
+            dedicatedCount--;
+            dedicatedBytes -= allocation.size;
+        }
+        else
+        {
+            MemoryBlock& block = *allocation.block;
+            block.allocator.free(allocation.node);
+
+            auto& typeBlocks = blocks[block.memoryType];
+            if (block.allocator.allocationCount() == 0 && typeBlocks.size() > 1)
+            {
+                vkFreeMemory(device, block.memory, nullptr);
+                memoryObjectCount--;
+                typeBlocks.erase(std::find_if(typeBlocks.begin(), typeBlocks.end(), [&](const std::unique_ptr<MemoryBlock>& candidate) { return candidate.get() == &block; }));
+            }
+        }
+        allocation = DeviceAllocation();
+    }
+
+    // Makes host writes to [offset, offset + size) of the allocation visible to the device. Only needed for
+    // memory that is not host coherent; the range is widened to whole atoms, which may cover neighbouring bytes.
+    void flush(const DeviceAllocation& allocation, VkDeviceSize offset, VkDeviceSize size) const
+    {
+        if (propertyFlags(allocation) & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+        {
+            return;
+        }
+
+        const VkDeviceSize memorySize = allocation.block ? allocation.block->size : allocation.size;
+        const VkDeviceSize begin      = (allocation.offset + offset) / nonCoherentAtomSize * nonCoherentAtomSize;
+        const VkDeviceSize end        = deviceAllocatorDetail::alignUp(allocation.offset + offset + size, nonCoherentAtomSize);
+
+        VkMappedMemoryRange range = {};
+        range.sType               = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        range.memory              = allocation.memory;
+        range.offset              = begin;
+        range.size                = end < memorySize ? end - begin : VK_WHOLE_SIZE;
+        vkFlushMappedMemoryRanges(device, 1, &range);
+    }
+
+    DeviceAllocatorStats stats()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        DeviceAllocatorStats result;
+        result.dedicatedCount = dedicatedCount;
+        result.dedicatedBytes = dedicatedBytes;
+
+        VkDeviceSize freeBytes = 0;
+        for (auto& typeBlocks : blocks)
+        {
+            for (auto& block : typeBlocks)
+            {
+                result.blockCount++;
+                result.blockBytes      += block->size;
+                result.usedBytes       += block->allocator.used();
+                result.allocationCount += block->allocator.allocationCount();
+                block->allocator.forEachFreeRange([&](VkDeviceSize size)
+                {
+                    result.freeRangeCount++;
+                    result.largestFreeRange = std::max(result.largestFreeRange, size);
+                    freeBytes              += size;
+                });
+            }
+        }
+        result.fragmentation = freeBytes > 0 ? 1.0f - float(result.largestFreeRange) / float(freeBytes) : 0.0f;
+        return result;
+    }
+
+private:
+    // 256 MiB heaps and smaller get blocks of an eighth of their size
+    VkDeviceSize preferredBlockSize(uint32_t memoryType) const
+    {
+        const VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryType].heapIndex].size;
+        return heapSize <= 256ull * 1024 * 1024 ? heapSize / 8 : 64ull * 1024 * 1024;
+    }
+
+    bool allocateFromBlock(MemoryBlock& block, const VkMemoryRequirements& requirements, ResourceKind kind, DeviceAllocation& allocation)
+    {
+        VkDeviceSize   offset;
+        const uint32_t node = block.allocator.allocate(requirements.size, std::max<VkDeviceSize>(1, requirements.alignment), kind, offset);
+        if (node == deviceAllocatorDetail::NO_NODE)
+        {
+            return false;
+        }
+
+        allocation.memory     = block.memory;
+        allocation.offset     = offset;
+        allocation.size       = requirements.size;
+        allocation.mapped     = block.mapped ? static_cast<uint8_t*>(block.mapped) + offset : nullptr;
+        allocation.block      = &block;
+        allocation.node       = node;
+        allocation.memoryType = block.memoryType;
+        return true;
+    }
+
+    VkDeviceMemory allocateMemory(VkDeviceSize size, uint32_t memoryType, void*& mapped)
+    {
+        if (memoryObjectCount >= maxAllocationCount)
+        {
+            throw std::runtime_error("exceeded maxMemoryAllocationCount!");
+        }
+
+        VkMemoryAllocateInfo allocInfo = {};
+        allocInfo.sType                = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize       = size;
+        allocInfo.memoryTypeIndex      = memoryType;
+
+        VkDeviceMemory memory;
+        if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to allocate device memory!");
+        }
+        memoryObjectCount++;
+
+        mapped = nullptr;
+        if (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+        {
+            vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &mapped);
+        }
+        return memory;
+    }
+
+    VkDevice                         device;
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    VkDeviceSize                     granularity         = 1;
+    VkDeviceSize                     nonCoherentAtomSize = 1;
+    uint32_t                         maxAllocationCount  = 4096;
+    uint32_t                         memoryObjectCount   = 0;
+    uint32_t                         dedicatedCount      = 0;
+    VkDeviceSize                     dedicatedBytes      = 0;
+    std::vector<std::vector<std::unique_ptr<MemoryBlock>>> blocks; // per memory type
+    std::mutex                       mutex;                        // the texture streamer allocates staging buffers too
+};
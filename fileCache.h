@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// Read-only memory mapping of a whole file.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    MappedFile(MappedFile&& other) noexcept
+    {
+        *this = std::move(other);
+    }
+
+    MappedFile& operator=(MappedFile&& other) noexcept
+    {
+        if (this != &other)
+        {
+            close();
+            mapping     = other.mapping;
+            mappingSize = other.mappingSize;
+            other.mapping     = nullptr;
+            other.mappingSize = 0;
+        }
+        return *this;
+    }
+
+    MappedFile(const MappedFile&)            = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path)
+    {
+        close();
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+        {
+            ::close(fd);
+            return false;
+        }
+
+        void* address = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (address == MAP_FAILED)
+        {
+            return false;
+        }
+
+        mapping     = static_cast<const uint8_t*>(address);
+        mappingSize = static_cast<size_t>(fileStat.st_size);
+        return true;
+    }
+
+    void close()
+    {
+        if (mapping)
+        {
+            munmap(const_cast<uint8_t*>(mapping), mappingSize);
+            mapping     = nullptr;
+            mappingSize = 0;
+        }
+    }
+
+    bool           isOpen() const { return mapping != nullptr; }
+    const uint8_t* data()   const { return mapping; }
+    size_t         size()   const { return mappingSize; }
+
+private:
+    const uint8_t* mapping     = nullptr;
+    size_t         mappingSize = 0;
+};
+
+
+// 64 bit content hash, used to key cache files on their source data.
+inline uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0)
+{
+    const uint64_t multiplier = 0x9E3779B97F4A7C15ull;
+    const uint8_t* bytes      = static_cast<const uint8_t*>(data);
+    uint64_t       hash       = seed ^ (size * multiplier);
+
+    auto mix = [](uint64_t value)
+    {
+        value ^= value >> 33;
+        value *= 0xFF51AFD7ED558CCDull;
+        value ^= value >> 33;
+        return value;
+    };
+
+    size_t offset = 0;
+    for (; offset + 8 <= size; offset += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, bytes + offset, 8);
+        hash = (hash ^ mix(word)) * multiplier;
+    }
+
+    uint64_t tail = 0;
+    std::memcpy(&tail, bytes + offset, size - offset);
+    hash = (hash ^ mix(tail)) * multiplier;
+
+    return mix(hash);
+}
+
+// Writes to a temporary file next to path and renames it into place, so readers never see partial files.
+inline bool writeFileAtomically(const std::string& path, const std::function<void(std::ofstream&)>& write)
+{
+    const std::string temporaryPath = path + ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            return false;
+        }
+        write(file);
+        file.flush();
+        if (!file.good())
+        {
+            file.close();
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+    }
+    return std::rename(temporaryPath.c_str(), path.c_str()) == 0;
+}
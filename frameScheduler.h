@@ -0,0 +1,261 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+// Paces the frames in flight. The n-th submitted frame signals value n on one timeline semaphore, so the
+// resources of slot n % framesInFlight are free again once value n - framesInFlight is reached. Devices
+// without VK_KHR_timeline_semaphore fall back to a fence per slot. Every wait gives up after the timeout and
+// reports it, so the caller can skip the frame and retry, only device errors throw.
+//
+// The latency of a frame runs from beginFrame() until the host sees the frame completed, which happens while
+// waiting for it or when beginning one of the next frames.
+//
+// Resources the submitted frames may still use are retired instead of destroyed, and beginFrame() destroys
+// them once those frames completed, so nothing has to wait for the device to idle.
+
+class FrameScheduler
+{
+public:
+    FrameScheduler(VkDevice device, uint32_t framesInFlight, bool timelineSemaphores, uint64_t timeoutNs)
+        : device(device)
+        , slotCount(std::max(1u, framesInFlight))
+        , timeoutNs(timeoutNs)
+        , slotFrames(slotCount, 0)
+    {
+        if (timelineSemaphores)
+        {
+            waitSemaphores      = reinterpret_cast<PFN_vkWaitSemaphoresKHR>(vkGetDeviceProcAddr(device, "vkWaitSemaphoresKHR"));
+            getSemaphoreCounter = reinterpret_cast<PFN_vkGetSemaphoreCounterValueKHR>(vkGetDeviceProcAddr(device, "vkGetSemaphoreCounterValueKHR"));
+        }
+
+        if (waitSemaphores && getSemaphoreCounter)
+        {
+            VkSemaphoreTypeCreateInfoKHR typeInfo = {};
+            typeInfo.sType                        = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+            typeInfo.semaphoreType                = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+            typeInfo.initialValue                 = 0;
+
+            VkSemaphoreCreateInfo semaphoreInfo = {};
+            semaphoreInfo.sType                 = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            semaphoreInfo.pNext                 = &typeInfo;
+
+            if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &timeline) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to create frame timeline semaphore!");
+            }
+            return;
+        }
+
+        VkFenceCreateInfo fenceInfo = {};
+        fenceInfo.sType             = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        fenceInfo.flags             = VK_FENCE_CREATE_SIGNALED_BIT;
+
+        fences.resize(slotCount);
+        for (VkFence& fence : fences)
+        {
+            if (vkCreateFence(device, &fenceInfo, nullptr, &fence) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to create frame fence!");
+            }
+        }
+    }
+
+    // Retired resources left over are destroyed here, which requires an idle device
+    ~FrameScheduler()
+    {
+        releaseRetired(frameNumber);
+        vkDestroySemaphore(device, timeline, nullptr);
+        for (VkFence fence : fences)
+        {
+            vkDestroyFence(device, fence, nullptr);
+        }
+    }
+
+    FrameScheduler(const FrameScheduler&)            = delete;
+    FrameScheduler& operator=(const FrameScheduler&) = delete;
+
+    uint32_t framesInFlight() const
+    {
+        return slotCount;
+    }
+
+    bool usesTimeline() const
+    {
+        return timeline != VK_NULL_HANDLE;
+    }
+
+    // Waits until the slot of the next frame is free again and returns it, nothing if the wait timed out
+    std::optional<uint32_t> beginFrame()
+    {
+        completed.clear();
+        if (frameNumber > slotCount && !waitForFrame(frameNumber - slotCount))
+        {
+            return std::nullopt;
+        }
+        const uint64_t lastCompleted = completedFrame();
+        collectCompleted(lastCompleted);
+        releaseRetired(lastCompleted);
+
+        // A frame given up before its submission begins again with its original start
+        if (frameStarts.empty() || frameStarts.back().first != frameNumber)
+        {
+            frameStarts.emplace_back(frameNumber, std::chrono::high_resolution_clock::now());
+        }
+        return slot();
+    }
+
+    // Waits until the device finished every frame submitted so far, false if the wait timed out
+    bool waitForSubmittedFrames()
+    {
+        return frameNumber <= 1 || waitForFrame(frameNumber - 1);
+    }
+
+    // Adds the completion signal of the current frame to its submission and returns the fence to submit with,
+    // null with a timeline semaphore. Both arguments must stay alive until the submission.
+    VkFence prepareSubmit(VkSubmitInfo& submitInfo, std::vector<VkSemaphore>& signalSemaphores)
+    {
+        slotFrames[slot()] = frameNumber;
+        if (!usesTimeline())
+        {
+            vkResetFences(device, 1, &fences[slot()]);
+            return fences[slot()];
+        }
+
+        signalSemaphores.push_back(timeline);
+        signalValues.assign(signalSemaphores.size(), 0); // ignored for the binary semaphores
+        signalValues.back() = frameNumber;
+
+        timelineInfo                           = {};
+        timelineInfo.sType                     = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+        timelineInfo.pNext                     = submitInfo.pNext;
+        timelineInfo.signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size());
+        timelineInfo.pSignalSemaphoreValues    = signalValues.data();
+        submitInfo.pNext                       = &timelineInfo;
+        return VK_NULL_HANDLE;
+    }
+
+    // The frame was submitted, the next beginFrame() moves on to the following slot
+    void endFrame()
+    {
+        frameNumber++;
+    }
+
+    // Runs destroy once every frame submitted so far completed
+    void retire(std::function<void()> destroy)
+    {
+        retired.emplace_back(frameNumber - 1, std::move(destroy));
+    }
+
+    size_t retiredCount() const
+    {
+        return retired.size();
+    }
+
+    // Latencies of the frames found completed by the last beginFrame(), in milliseconds
+    const std::vector<float>& completedLatencies() const
+    {
+        return completed;
+    }
+
+private:
+    uint32_t slot() const
+    {
+        return static_cast<uint32_t>((frameNumber - 1) % slotCount);
+    }
+
+    bool waitForFrame(uint64_t frame)
+    {
+        VkResult result;
+        if (usesTimeline())
+        {
+            VkSemaphoreWaitInfoKHR waitInfo = {};
+            waitInfo.sType                  = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+            waitInfo.semaphoreCount         = 1;
+            waitInfo.pSemaphores            = &timeline;
+            waitInfo.pValues                = &frame;
+            result = waitSemaphores(device, &waitInfo, timeoutNs);
+        }
+        else
+        {
+            const size_t frameSlot = (frame - 1) % slotCount;
+            result = slotFrames[frameSlot] == frame ? vkWaitForFences(device, 1, &fences[frameSlot], VK_TRUE, timeoutNs) : VK_SUCCESS;
+        }
+
+        if (result == VK_TIMEOUT)
+        {
+            return false;
+        }
+        if (result != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to wait for frame " + std::to_string(frame) + "!");
+        }
+        collectCompleted(frame);
+        return true;
+    }
+
+    // Frames complete in submission order, so the newest completed one covers all before it
+    uint64_t completedFrame() const
+    {
+        uint64_t frame = 0;
+        if (usesTimeline())
+        {
+            getSemaphoreCounter(device, timeline, &frame);
+            return frame;
+        }
+
+        for (size_t i = 0; i < slotCount; i++)
+        {
+            if (slotFrames[i] > frame && vkGetFenceStatus(device, fences[i]) == VK_SUCCESS)
+            {
+                frame = slotFrames[i];
+            }
+        }
+        return frame;
+    }
+
+    void releaseRetired(uint64_t frame)
+    {
+        while (!retired.empty() && retired.front().first <= frame)
+        {
+            retired.front().second();
+            retired.pop_front();
+        }
+    }
+
+    void collectCompleted(uint64_t frame)
+    {
+        const auto now = std::chrono::high_resolution_clock::now();
+        while (!frameStarts.empty() && frameStarts.front().first <= frame)
+        {
+            completed.push_back(std::chrono::duration<float, std::chrono::milliseconds::period>(now - frameStarts.front().second).count());
+            frameStarts.pop_front();
+        }
+    }
+
+    VkDevice                          device;
+    uint32_t                          slotCount;
+    uint64_t                          timeoutNs;
+    uint64_t                          frameNumber = 1; // of the frame being prepared
+    std::vector<uint64_t>             slotFrames;      // last frame submitted from each slot
+    VkSemaphore                       timeline    = VK_NULL_HANDLE;
+    std::vector<VkFence>              fences;          // without timeline semaphores
+    PFN_vkWaitSemaphoresKHR           waitSemaphores      = nullptr;
+    PFN_vkGetSemaphoreCounterValueKHR getSemaphoreCounter = nullptr;
+    VkTimelineSemaphoreSubmitInfoKHR  timelineInfo = {};
+    std::vector<uint64_t>             signalValues;
+    std::deque<std::pair<uint64_t, std::chrono::high_resolution_clock::time_point>> frameStarts; // frames not known to be complete
+    std::vector<float>                completed;
+    std::deque<std::pair<uint64_t, std::function<void()>>> retired; // destructions waiting for a frame to complete
+};
@@ -0,0 +1,397 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Worker threads with a deque of jobs each. A worker queues the jobs it submits on its own deque and takes the
+// newest one from the back, idle workers steal the oldest ones from the front of the others. The thread calling
+// wait() takes part as worker 0, so a system of size 1 runs everything on the caller.
+// Unlike ThreadPool batches, jobs may submit further jobs.
+class JobSystem
+{
+public:
+    using Job = std::function<void()>;
+
+    explicit JobSystem(size_t threadCount = 0)
+    {
+        if (threadCount == 0)
+        {
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        for (size_t i = 0; i < threadCount; i++)
+        {
+            queues.push_back(std::make_unique<Queue>());
+        }
+        for (size_t i = 1; i < threadCount; i++)
+        {
+            workers.emplace_back([this, i]{ workerLoop(i); });
+        }
+    }
+
+    ~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    JobSystem(const JobSystem&)            = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    size_t size() const
+    {
+        return queues.size();
+    }
+
+    uint64_t stolenJobs() const
+    {
+        return steals;
+    }
+
+    // Index of the calling worker, 0 for threads outside of the system
+    size_t currentThread() const
+    {
+        return current().system == this ? current().thread : 0;
+    }
+
+    void submit(Job job)
+    {
+        Queue& queue = *queues[currentThread()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.jobs.push_back(std::move(job));
+        }
+        queued++;
+
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        wake.notify_one();
+    }
+
+    // Runs jobs on the calling thread until done() holds, done() is checked after every finished job
+    void wait(const std::function<bool()>& done)
+    {
+        WorkerIndex&      index    = current();
+        const WorkerIndex previous = index;
+        index                      = {this, 0};
+
+        while (true)
+        {
+            if (tryRun(0))
+            {
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            if (done())
+            {
+                break;
+            }
+            wake.wait(lock, [&]{ return queued > 0 || done(); });
+        }
+        index = previous;
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex      mutex;
+        std::deque<Job> jobs;
+    };
+
+    struct WorkerIndex
+    {
+        const JobSystem* system = nullptr;
+        size_t           thread = 0;
+    };
+
+    static WorkerIndex& current()
+    {
+        static thread_local WorkerIndex index;
+        return index;
+    }
+
+    void workerLoop(size_t thread)
+    {
+        current() = {this, thread};
+        while (true)
+        {
+            if (tryRun(thread))
+            {
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this]{ return stopping || queued > 0; });
+            if (stopping)
+            {
+                return;
+            }
+        }
+    }
+
+    // Own jobs newest first, then the oldest job of the next deque that has one
+    bool tryRun(size_t thread)
+    {
+        Job job;
+        for (size_t i = 0; i < queues.size() && !job; i++)
+        {
+            Queue& queue = *queues[(thread + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.jobs.empty())
+            {
+                continue;
+            }
+            if (i == 0)
+            {
+                job = std::move(queue.jobs.back());
+                queue.jobs.pop_back();
+            }
+            else
+            {
+                job = std::move(queue.jobs.front());
+                queue.jobs.pop_front();
+                steals++;
+            }
+        }
+        if (!job)
+        {
+            return false;
+        }
+        queued--;
+
+        job();
+
+        // Waiters check their condition after every job
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        wake.notify_all();
+        return true;
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread>            workers;
+    std::mutex                          sleepMutex;
+    std::condition_variable             wake;
+    std::atomic<size_t>                 queued{0};
+    std::atomic<uint64_t>               steals{0}; // jobs taken from another worker's deque
+    bool                                stopping = false;
+};
+
+struct JobTiming
+{
+    std::string name;
+    float       startMs        = 0.0f; // since the start of the run
+    float       endMs          = 0.0f;
+    size_t      thread         = 0;
+    bool        onCriticalPath = false;
+};
+
+// Jobs with dependencies on earlier jobs, started as soon as all of them finished. After a failed job the
+// remaining ones are skipped and run() rethrows its exception.
+class JobGraph
+{
+public:
+    uint32_t add(const std::string& name, std::function<void()> job, const std::vector<uint32_t>& dependencies = {})
+    {
+        const uint32_t index = static_cast<uint32_t>(nodes.size());
+        Node node;
+        node.name = name;
+        node.job  = std::move(job);
+        for (uint32_t dependency : dependencies)
+        {
+            if (dependency >= index)
+            {
+                throw std::invalid_argument("job " + name + " depends on a job added after it");
+            }
+            nodes[dependency].dependents.push_back(index);
+        }
+        node.dependencies = dependencies;
+        nodes.push_back(std::move(node));
+        return index;
+    }
+
+    void run(JobSystem& jobs)
+    {
+        finished = 0;
+        failure  = nullptr;
+        timings.assign(nodes.size(), JobTiming());
+        std::vector<uint32_t> roots;
+        for (uint32_t i = 0; i < nodes.size(); i++)
+        {
+            nodes[i].remaining = static_cast<uint32_t>(nodes[i].dependencies.size());
+            if (nodes[i].remaining == 0)
+            {
+                roots.push_back(i);
+            }
+        }
+
+        start = std::chrono::high_resolution_clock::now();
+        for (uint32_t root : roots)
+        {
+            jobs.submit([this, &jobs, root]{ runNode(jobs, root); });
+        }
+        jobs.wait([this]{ return finished == nodes.size(); });
+
+        wallMs = elapsedMs();
+        if (failure)
+        {
+            std::rethrow_exception(failure);
+        }
+        findCriticalPath();
+    }
+
+    // Wall time of the last run
+    float lengthMs() const
+    {
+        return wallMs;
+    }
+
+    // Time the jobs took one after the other
+    float serialMs() const
+    {
+        float total = 0.0f;
+        for (const JobTiming& timing : timings)
+        {
+            total += timing.endMs - timing.startMs;
+        }
+        return total;
+    }
+
+    // The longest chain of dependent jobs, the shortest the run can get with enough threads
+    float criticalPathMs() const
+    {
+        return criticalPath;
+    }
+
+    // In order of their start
+    std::vector<JobTiming> timeline() const
+    {
+        std::vector<JobTiming> sorted = timings;
+        std::sort(sorted.begin(), sorted.end(), [](const JobTiming& a, const JobTiming& b){ return a.startMs < b.startMs; });
+        return sorted;
+    }
+
+private:
+    struct Node
+    {
+        std::string           name;
+        std::function<void()> job;
+        std::vector<uint32_t> dependencies;
+        std::vector<uint32_t> dependents;
+        uint32_t              remaining = 0; // unfinished dependencies
+    };
+
+    float elapsedMs() const
+    {
+        return std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    void runNode(JobSystem& jobs, uint32_t index)
+    {
+        JobTiming timing;
+        timing.name    = nodes[index].name;
+        timing.thread  = jobs.currentThread();
+        timing.startMs = elapsedMs();
+
+        bool skip;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            skip = failure != nullptr;
+        }
+        if (!skip)
+        {
+            try
+            {
+                nodes[index].job();
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!failure)
+                {
+                    failure = std::current_exception();
+                }
+            }
+        }
+        timing.endMs = elapsedMs();
+
+        std::vector<uint32_t> ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            timings[index] = timing;
+            for (uint32_t dependent : nodes[index].dependents)
+            {
+                if (--nodes[dependent].remaining == 0)
+                {
+                    ready.push_back(dependent);
+                }
+            }
+        }
+        for (uint32_t dependent : ready)
+        {
+            jobs.submit([this, &jobs, dependent]{ runNode(jobs, dependent); });
+        }
+        finished++;
+    }
+
+    // Jobs only depend on earlier ones, so one pass in order finds the longest path to every job
+    void findCriticalPath()
+    {
+        std::vector<float>   pathMs(nodes.size(), 0.0f);
+        std::vector<int32_t> predecessor(nodes.size(), -1);
+        int32_t              last = -1;
+        criticalPath = 0.0f;
+        for (uint32_t i = 0; i < nodes.size(); i++)
+        {
+            for (uint32_t dependency : nodes[i].dependencies)
+            {
+                if (pathMs[dependency] > pathMs[i])
+                {
+                    pathMs[i]      = pathMs[dependency];
+                    predecessor[i] = static_cast<int32_t>(dependency);
+                }
+            }
+            pathMs[i] += timings[i].endMs - timings[i].startMs;
+            if (pathMs[i] > criticalPath)
+            {
+                criticalPath = pathMs[i];
+                last         = static_cast<int32_t>(i);
+            }
+        }
+
+        for (int32_t i = last; i >= 0; i = predecessor[i])
+        {
+            timings[i].onCriticalPath = true;
+        }
+    }
+
+    std::vector<Node>      nodes;
+    std::mutex             mutex;
+    std::atomic<size_t>    finished{0};
+    std::exception_ptr     failure = nullptr;
+    std::vector<JobTiming> timings;
+    std::chrono::high_resolution_clock::time_point start;
+    float                  wallMs       = 0.0f;
+    float                  criticalPath = 0.0f;
+};
@@ -0,0 +1,451 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+
+// Triangle and vertex reordering for indexed triangle lists, plus the statistics to judge them.
+// Positions are passed as a float xyz triple at the start of every positionStride bytes.
+
+struct VertexCacheStatistics
+{
+    size_t misses = 0;
+    float  acmr   = 0.0f; // average cache miss ratio: transformed vertices per triangle, 0.5 is the optimum for big meshes
+    float  atvr   = 0.0f; // average transformed vertex ratio: transformed vertices per referenced vertex, 1.0 is the optimum
+};
+
+struct OverdrawStatistics
+{
+    size_t pixelsCovered = 0;
+    size_t pixelsShaded  = 0;
+    float  overdraw      = 0.0f; // shaded per covered pixel, 1.0 is the optimum
+};
+
+
+namespace meshOptimizerDetail
+{
+    inline const float* position(const float* positions, size_t positionStride, uint32_t vertex)
+    {
+        return reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + vertex * positionStride);
+    }
+
+    // FIFO post-transform cache simulated with insertion timestamps
+    struct CacheSimulation
+    {
+        CacheSimulation(size_t vertexCount, size_t cacheSize)
+            : insertTime(vertexCount, 0)
+            , cacheSize(cacheSize)
+            , time(cacheSize + 1)
+        {
+        }
+
+        bool isCached(uint32_t vertex) const
+        {
+            return time - insertTime[vertex] <= cacheSize;
+        }
+
+        // Returns true on a cache miss
+        bool access(uint32_t vertex)
+        {
+            if (isCached(vertex))
+            {
+                return false;
+            }
+            insertTime[vertex] = time++;
+            return true;
+        }
+
+        void flush()
+        {
+            time += cacheSize + 1;
+        }
+
+        std::vector<size_t> insertTime;
+        size_t              cacheSize;
+        size_t              time;
+    };
+}
+
+
+inline VertexCacheStatistics analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, size_t cacheSize)
+{
+    meshOptimizerDetail::CacheSimulation cache(vertexCount, cacheSize);
+    std::vector<bool>                    referenced(vertexCount, false);
+
+    VertexCacheStatistics statistics;
+    size_t                referencedCount = 0;
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        statistics.misses += cache.access(indices[i]);
+        if (!referenced[indices[i]])
+        {
+            referenced[indices[i]] = true;
+            referencedCount++;
+        }
+    }
+
+    statistics.acmr = indexCount ? float(statistics.misses) / float(indexCount / 3) : 0.0f;
+    statistics.atvr = referencedCount ? float(statistics.misses) / float(referencedCount) : 0.0f;
+    return statistics;
+}
+
+// Rasterizes the mesh in submission order with depth test and back face culling from the six axis directions
+// and counts how often a pixel gets shaded again after it was covered.
+inline OverdrawStatistics analyzeOverdraw(const uint32_t* indices, size_t indexCount, const float* positions, size_t positionStride, size_t vertexCount, int gridSize = 256)
+{
+    using meshOptimizerDetail::position;
+
+    OverdrawStatistics statistics;
+    if (indexCount == 0 || vertexCount == 0)
+    {
+        return statistics;
+    }
+
+    float minimum[3] = {position(positions, positionStride, 0)[0], position(positions, positionStride, 0)[1], position(positions, positionStride, 0)[2]};
+    float maximum[3] = {minimum[0], minimum[1], minimum[2]};
+    for (uint32_t vertex = 0; vertex < vertexCount; vertex++)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            minimum[axis] = std::min(minimum[axis], position(positions, positionStride, vertex)[axis]);
+            maximum[axis] = std::max(maximum[axis], position(positions, positionStride, vertex)[axis]);
+        }
+    }
+    const float extent = std::max({maximum[0] - minimum[0], maximum[1] - minimum[1], maximum[2] - minimum[2], 1e-12f});
+
+    // Right handed (u, v, towards viewer) axis triples, one per view direction; depth grows away from the viewer
+    const int   viewAxes[6][3]  = {{1, 2, 0}, {2, 1, 0}, {2, 0, 1}, {0, 2, 1}, {0, 1, 2}, {1, 0, 2}};
+    const float viewSigns[6][3] = {{1, 1, 1}, {1, 1, -1}, {1, 1, 1}, {1, 1, -1}, {1, 1, 1}, {1, 1, -1}};
+
+    std::vector<float> depth(size_t(gridSize) * gridSize);
+    for (int view = 0; view < 6; view++)
+    {
+        std::fill(depth.begin(), depth.end(), std::numeric_limits<float>::max());
+
+        for (size_t triangle = 0; triangle + 2 < indexCount; triangle += 3)
+        {
+            float u[3], v[3], z[3];
+            for (int corner = 0; corner < 3; corner++)
+            {
+                const float* p = position(positions, positionStride, indices[triangle + corner]);
+                u[corner] = viewSigns[view][0] * (p[viewAxes[view][0]] - minimum[viewAxes[view][0]]) / extent * gridSize;
+                v[corner] = viewSigns[view][1] * (p[viewAxes[view][1]] - minimum[viewAxes[view][1]]) / extent * gridSize;
+                z[corner] = -viewSigns[view][2] * p[viewAxes[view][2]];
+            }
+
+            const float area = (u[1] - u[0]) * (v[2] - v[0]) - (u[2] - u[0]) * (v[1] - v[0]);
+            if (area <= 0.0f)
+            {
+                continue;
+            }
+
+            const int minU = std::max(0, int(std::floor(std::min({u[0], u[1], u[2]}))));
+            const int maxU = std::min(gridSize - 1, int(std::ceil(std::max({u[0], u[1], u[2]}))));
+            const int minV = std::max(0, int(std::floor(std::min({v[0], v[1], v[2]}))));
+            const int maxV = std::min(gridSize - 1, int(std::ceil(std::max({v[0], v[1], v[2]}))));
+
+            for (int y = minV; y <= maxV; y++)
+            {
+                for (int x = minU; x <= maxU; x++)
+                {
+                    const float px = x + 0.5f;
+                    const float py = y + 0.5f;
+                    const float w0 = (u[2] - u[1]) * (py - v[1]) - (v[2] - v[1]) * (px - u[1]);
+                    const float w1 = (u[0] - u[2]) * (py - v[2]) - (v[0] - v[2]) * (px - u[2]);
+                    const float w2 = (u[1] - u[0]) * (py - v[0]) - (v[1] - v[0]) * (px - u[0]);
+                    if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+                    {
+                        continue;
+                    }
+
+                    const float fragmentDepth = (w0 * z[0] + w1 * z[1] + w2 * z[2]) / area;
+                    float&      storedDepth   = depth[size_t(y) * gridSize + x];
+                    if (fragmentDepth < storedDepth)
+                    {
+                        statistics.pixelsCovered += storedDepth == std::numeric_limits<float>::max();
+                        statistics.pixelsShaded++;
+                        storedDepth = fragmentDepth;
+                    }
+                }
+            }
+        }
+    }
+
+    statistics.overdraw = statistics.pixelsCovered ? float(statistics.pixelsShaded) / float(statistics.pixelsCovered) : 0.0f;
+    return statistics;
+}
+
+// Tipsify (Sander, Nehab, Barczak: "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw", 2007).
+// Writes the reordered triangles to destination, which must not alias indices. If clusterStarts is given it
+// receives the first triangle of every run that starts with a cold cache, for use by optimizeOverdraw.
+inline void optimizeVertexCache(uint32_t* destination, const uint32_t* indices, size_t indexCount, size_t vertexCount, size_t cacheSize, std::vector<uint32_t>* clusterStarts = nullptr)
+{
+    const uint32_t invalidVertex = ~0u;
+    const size_t   triangleCount = indexCount / 3;
+
+    std::vector<uint32_t> liveTriangles(vertexCount, 0);
+    for (size_t i = 0; i < triangleCount * 3; i++)
+    {
+        liveTriangles[indices[i]]++;
+    }
+
+    std::vector<uint32_t> adjacencyOffset(vertexCount + 1, 0);
+    for (size_t vertex = 0; vertex < vertexCount; vertex++)
+    {
+        adjacencyOffset[vertex + 1] = adjacencyOffset[vertex] + liveTriangles[vertex];
+    }
+
+    std::vector<uint32_t> adjacency(triangleCount * 3);
+    std::vector<uint32_t> adjacencyFill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+    for (size_t i = 0; i < triangleCount * 3; i++)
+    {
+        adjacency[adjacencyFill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+
+    meshOptimizerDetail::CacheSimulation cache(vertexCount, cacheSize);
+    std::vector<bool>                    emitted(triangleCount, false);
+    std::vector<uint32_t>                deadEnd;
+    std::vector<uint32_t>                candidates;
+    size_t                               scanCursor      = 0;
+    size_t                               outputTriangles = 0;
+
+    auto skipDeadEnd = [&]()
+    {
+        while (!deadEnd.empty())
+        {
+            const uint32_t vertex = deadEnd.back();
+            deadEnd.pop_back();
+            if (liveTriangles[vertex] > 0)
+            {
+                return vertex;
+            }
+        }
+        for (; scanCursor < vertexCount; scanCursor++)
+        {
+            if (liveTriangles[scanCursor] > 0)
+            {
+                return static_cast<uint32_t>(scanCursor);
+            }
+        }
+        return invalidVertex;
+    };
+
+    uint32_t fanning = skipDeadEnd();
+    while (fanning != invalidVertex)
+    {
+        if (clusterStarts && !cache.isCached(fanning))
+        {
+            if (clusterStarts->empty() || clusterStarts->back() != outputTriangles)
+            {
+                clusterStarts->push_back(static_cast<uint32_t>(outputTriangles));
+            }
+        }
+
+        candidates.clear();
+        for (uint32_t a = adjacencyOffset[fanning]; a < adjacencyOffset[fanning + 1]; a++)
+        {
+            const uint32_t triangle = adjacency[a];
+            if (emitted[triangle])
+            {
+                continue;
+            }
+
+            for (int corner = 0; corner < 3; corner++)
+            {
+                const uint32_t vertex = indices[triangle * 3 + corner];
+                destination[outputTriangles * 3 + corner] = vertex;
+                deadEnd.push_back(vertex);
+                candidates.push_back(vertex);
+                liveTriangles[vertex]--;
+                cache.access(vertex);
+            }
+            emitted[triangle] = true;
+            outputTriangles++;
+        }
+
+        // Prefer the candidate that stays in the cache longest while all its remaining triangles are emitted
+        uint32_t next         = invalidVertex;
+        int64_t  bestPriority = -1;
+        for (uint32_t vertex : candidates)
+        {
+            if (liveTriangles[vertex] == 0)
+            {
+                continue;
+            }
+
+            const int64_t age      = static_cast<int64_t>(cache.time - cache.insertTime[vertex]);
+            int64_t       priority = 0;
+            if (age + 2 * static_cast<int64_t>(liveTriangles[vertex]) <= static_cast<int64_t>(cacheSize))
+            {
+                priority = age;
+            }
+            if (priority > bestPriority)
+            {
+                bestPriority = priority;
+                next         = vertex;
+            }
+        }
+
+        fanning = next != invalidVertex ? next : skipDeadEnd();
+    }
+}
+
+// Splits the vertex cache optimized triangle order into clusters and sorts them so that clusters facing away
+// from the mesh center are drawn first. threshold limits the allowed ACMR increase, 1.05 allows 5%.
+inline void optimizeOverdraw(uint32_t* indices, size_t indexCount, const float* positions, size_t positionStride, size_t vertexCount, const std::vector<uint32_t>& hardClusterStarts, size_t cacheSize, float threshold)
+{
+    using meshOptimizerDetail::position;
+
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+    {
+        return;
+    }
+
+    // Cut the hard clusters further wherever the running miss ratio drops to the cluster average
+    std::vector<uint32_t>                clusterStarts;
+    meshOptimizerDetail::CacheSimulation cache(vertexCount, cacheSize);
+    for (size_t hard = 0; hard < hardClusterStarts.size(); hard++)
+    {
+        const size_t begin = hardClusterStarts[hard];
+        const size_t end   = hard + 1 < hardClusterStarts.size() ? hardClusterStarts[hard + 1] : triangleCount;
+
+        cache.flush();
+        size_t clusterMisses = 0;
+        for (size_t i = begin * 3; i < end * 3; i++)
+        {
+            clusterMisses += cache.access(indices[i]);
+        }
+        const float clusterThreshold = threshold * float(clusterMisses) / float(end - begin);
+
+        cache.flush();
+        size_t start  = begin;
+        size_t misses = 0;
+        clusterStarts.push_back(static_cast<uint32_t>(begin));
+        for (size_t triangle = begin; triangle < end; triangle++)
+        {
+            for (int corner = 0; corner < 3; corner++)
+            {
+                misses += cache.access(indices[triangle * 3 + corner]);
+            }
+
+            if (triangle + 1 < end && float(misses) <= clusterThreshold * float(triangle + 1 - start))
+            {
+                clusterStarts.push_back(static_cast<uint32_t>(triangle + 1));
+                start  = triangle + 1;
+                misses = 0;
+                cache.flush();
+            }
+        }
+    }
+
+    // Area weighted centroid and normal of the mesh and of every cluster
+    struct Cluster
+    {
+        uint32_t begin;
+        uint32_t end;
+        float    sortKey;
+    };
+
+    std::vector<Cluster> clusters(clusterStarts.size());
+    std::vector<float>   clusterData(clusterStarts.size() * 7, 0.0f); // centroid xyz * area, normal xyz, area
+    float                meshCentroid[3] = {0.0f, 0.0f, 0.0f};
+    float                meshArea        = 0.0f;
+
+    for (size_t c = 0; c < clusterStarts.size(); c++)
+    {
+        clusters[c].begin = clusterStarts[c];
+        clusters[c].end   = c + 1 < clusterStarts.size() ? clusterStarts[c + 1] : static_cast<uint32_t>(triangleCount);
+
+        float* data = &clusterData[c * 7];
+        for (uint32_t triangle = clusters[c].begin; triangle < clusters[c].end; triangle++)
+        {
+            const float* p0 = position(positions, positionStride, indices[triangle * 3 + 0]);
+            const float* p1 = position(positions, positionStride, indices[triangle * 3 + 1]);
+            const float* p2 = position(positions, positionStride, indices[triangle * 3 + 2]);
+
+            const float e1[3]  = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+            const float e2[3]  = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+            const float n[3]   = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+            const float area   = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+            for (int axis = 0; axis < 3; axis++)
+            {
+                data[axis]     += (p0[axis] + p1[axis] + p2[axis]) / 3.0f * area;
+                data[3 + axis] += n[axis];
+            }
+            data[6] += area;
+        }
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            meshCentroid[axis] += data[axis];
+        }
+        meshArea += data[6];
+    }
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        meshCentroid[axis] = meshArea > 0.0f ? meshCentroid[axis] / meshArea : 0.0f;
+    }
+
+    for (size_t c = 0; c < clusters.size(); c++)
+    {
+        const float* data       = &clusterData[c * 7];
+        const float  normalSize = std::sqrt(data[3] * data[3] + data[4] * data[4] + data[5] * data[5]);
+        float        key        = 0.0f;
+        if (data[6] > 0.0f && normalSize > 0.0f)
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                key += (data[axis] / data[6] - meshCentroid[axis]) * data[3 + axis] / normalSize;
+            }
+        }
+        clusters[c].sortKey = key;
+    }
+
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+    std::vector<uint32_t> reordered;
+    reordered.reserve(triangleCount * 3);
+    for (const Cluster& cluster : clusters)
+    {
+        reordered.insert(reordered.end(), indices + cluster.begin * 3, indices + cluster.end * 3);
+    }
+    std::copy(reordered.begin(), reordered.end(), indices);
+}
+
+// Renumbers vertices in the order the index buffer first references them, dropping unreferenced ones.
+// Returns the new vertex count.
+template<typename VertexType>
+size_t optimizeVertexFetch(std::vector<VertexType>& vertices, std::vector<uint32_t>& indices)
+{
+    const uint32_t        unassigned = ~0u;
+    std::vector<uint32_t> remap(vertices.size(), unassigned);
+    uint32_t              nextVertex = 0;
+
+    for (uint32_t& index : indices)
+    {
+        if (remap[index] == unassigned)
+        {
+            remap[index] = nextVertex++;
+        }
+        index = remap[index];
+    }
+
+    std::vector<VertexType> reordered(nextVertex);
+    for (size_t vertex = 0; vertex < vertices.size(); vertex++)
+    {
+        if (remap[vertex] != unassigned)
+        {
+            reordered[remap[vertex]] = vertices[vertex];
+        }
+    }
+    vertices.swap(reordered);
+    return nextVertex;
+}
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+// Quadric error edge collapse (Garland, Heckbert: "Surface Simplification Using Quadric Error Metrics", 1997).
+// Vertices only ever collapse onto existing vertices, so the result indexes the original vertex buffer.
+// Vertices on index space borders stay in place; that keeps open boundaries as well as texture seams intact.
+
+namespace meshSimplifierDetail
+{
+    // Area weighted sum of plane equations, a symmetric 4x4 matrix stored as its upper triangle
+    struct Quadric
+    {
+        double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+        double a11 = 0, a12 = 0, a13 = 0;
+        double a22 = 0, a23 = 0;
+        double a33 = 0;
+        double weight = 0;
+
+        void addPlane(double x, double y, double z, double w, double area)
+        {
+            a00 += area * x * x; a01 += area * x * y; a02 += area * x * z; a03 += area * x * w;
+            a11 += area * y * y; a12 += area * y * z; a13 += area * y * w;
+            a22 += area * z * z; a23 += area * z * w;
+            a33 += area * w * w;
+            weight += area;
+        }
+
+        void add(const Quadric& other)
+        {
+            a00 += other.a00; a01 += other.a01; a02 += other.a02; a03 += other.a03;
+            a11 += other.a11; a12 += other.a12; a13 += other.a13;
+            a22 += other.a22; a23 += other.a23;
+            a33 += other.a33;
+            weight += other.weight;
+        }
+
+        // Area weighted mean squared distance of p to the accumulated planes
+        double error(const float* p) const
+        {
+            const double x = p[0], y = p[1], z = p[2];
+            const double sum = x * x * a00 + y * y * a11 + z * z * a22 + a33
+                             + 2.0 * (x * y * a01 + x * z * a02 + y * z * a12 + x * a03 + y * a13 + z * a23);
+            return weight > 0.0 ? sum / weight : 0.0;
+        }
+    };
+
+    struct Collapse
+    {
+        uint32_t from;
+        uint32_t to;
+        double   error;
+    };
+
+    inline void triangleNormal(const float* p0, const float* p1, const float* p2, double* normal)
+    {
+        const double e1[3] = {double(p1[0]) - p0[0], double(p1[1]) - p0[1], double(p1[2]) - p0[2]};
+        const double e2[3] = {double(p2[0]) - p0[0], double(p2[1]) - p0[1], double(p2[2]) - p0[2]};
+        normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+    }
+}
+
+// Collapses edges until at most targetIndexCount indices remain or no collapse is possible any more.
+// error receives the square root of the largest quadric error accepted, an estimate of the deviation in model units.
+inline std::vector<uint32_t> simplifyMesh(const uint32_t* indices, size_t indexCount, const float* positions, size_t positionStride, size_t vertexCount, size_t targetIndexCount, float& error)
+{
+    using namespace meshSimplifierDetail;
+
+    auto position = [&](uint32_t vertex)
+    {
+        return reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + vertex * positionStride);
+    };
+
+    std::vector<uint32_t> result(indices, indices + indexCount / 3 * 3);
+    std::vector<Quadric>  quadrics(vertexCount);
+    std::vector<bool>     locked(vertexCount, false);
+    double                maximumError = 0.0;
+
+    for (size_t i = 0; i < result.size(); i += 3)
+    {
+        double normal[3];
+        triangleNormal(position(result[i]), position(result[i + 1]), position(result[i + 2]), normal);
+        const double length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        if (length == 0.0)
+        {
+            continue;
+        }
+
+        const float* p0 = position(result[i]);
+        const double x = normal[0] / length, y = normal[1] / length, z = normal[2] / length;
+        const double w = -(x * p0[0] + y * p0[1] + z * p0[2]);
+        for (size_t corner = 0; corner < 3; corner++)
+        {
+            quadrics[result[i + corner]].addPlane(x, y, z, w, length * 0.5);
+        }
+    }
+
+    // An edge used by exactly one triangle is a border; border vertices never move
+    {
+        std::vector<uint64_t> edges;
+        edges.reserve(result.size());
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            for (size_t corner = 0; corner < 3; corner++)
+            {
+                const uint32_t a = result[i + corner];
+                const uint32_t b = result[i + (corner + 1) % 3];
+                edges.push_back(uint64_t(std::min(a, b)) << 32 | std::max(a, b));
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+
+        for (size_t i = 0; i < edges.size();)
+        {
+            size_t end = i + 1;
+            while (end < edges.size() && edges[end] == edges[i])
+            {
+                end++;
+            }
+            if (end - i == 1)
+            {
+                locked[uint32_t(edges[i] >> 32)]         = true;
+                locked[uint32_t(edges[i] & 0xFFFFFFFFu)] = true;
+            }
+            i = end;
+        }
+    }
+
+    std::vector<uint32_t> adjacencyOffset(vertexCount + 1);
+    std::vector<uint32_t> adjacency;
+    std::vector<uint32_t> remap(vertexCount);
+    std::vector<bool>     touched(vertexCount);
+    std::vector<Collapse> collapses;
+
+    // Every pass collapses an independent set of the cheapest edges, then rebuilds the triangle list
+    while (result.size() > targetIndexCount)
+    {
+        std::fill(adjacencyOffset.begin(), adjacencyOffset.end(), 0);
+        for (uint32_t vertex : result)
+        {
+            adjacencyOffset[vertex + 1]++;
+        }
+        for (size_t vertex = 0; vertex < vertexCount; vertex++)
+        {
+            adjacencyOffset[vertex + 1] += adjacencyOffset[vertex];
+        }
+        adjacency.resize(result.size());
+        std::vector<uint32_t> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+        for (size_t i = 0; i < result.size(); i++)
+        {
+            adjacency[fill[result[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+
+        collapses.clear();
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            for (size_t corner = 0; corner < 3; corner++)
+            {
+                const uint32_t a = result[i + corner];
+                const uint32_t b = result[i + (corner + 1) % 3];
+                for (const auto& [from, to] : {std::make_pair(a, b), std::make_pair(b, a)})
+                {
+                    if (!locked[from])
+                    {
+                        Quadric quadric = quadrics[from];
+                        quadric.add(quadrics[to]);
+                        collapses.push_back({from, to, std::max(0.0, quadric.error(position(to)))});
+                    }
+                }
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.error < y.error; });
+
+        // Each collapse removes about two triangles
+        const size_t collapsesNeeded = (result.size() - targetIndexCount) / 6 + 1;
+        size_t       collapsesDone   = 0;
+        for (size_t vertex = 0; vertex < vertexCount; vertex++)
+        {
+            remap[vertex] = static_cast<uint32_t>(vertex);
+        }
+        std::fill(touched.begin(), touched.end(), false);
+
+        for (const Collapse& collapse : collapses)
+        {
+            if (collapsesDone >= collapsesNeeded)
+            {
+                break;
+            }
+            if (touched[collapse.from] || touched[collapse.to])
+            {
+                continue;
+            }
+
+            // Reject collapses that flip a remaining triangle around the moving vertex
+            bool flips = false;
+            for (uint32_t a = adjacencyOffset[collapse.from]; a < adjacencyOffset[collapse.from + 1] && !flips; a++)
+            {
+                const uint32_t* triangle = &result[adjacency[a] * 3];
+                if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+                {
+                    continue;
+                }
+
+                const float* before[3];
+                const float* after[3];
+                for (size_t corner = 0; corner < 3; corner++)
+                {
+                    before[corner] = position(triangle[corner]);
+                    after[corner]  = triangle[corner] == collapse.from ? position(collapse.to) : before[corner];
+                }
+
+                double normalBefore[3], normalAfter[3];
+                triangleNormal(before[0], before[1], before[2], normalBefore);
+                triangleNormal(after[0], after[1], after[2], normalAfter);
+                flips = normalBefore[0] * normalAfter[0] + normalBefore[1] * normalAfter[1] + normalBefore[2] * normalAfter[2] <= 0.0;
+            }
+            if (flips)
+            {
+                continue;
+            }
+
+            // Freeze the whole neighbourhood so the flip test above stays valid for the rest of the pass
+            for (uint32_t a = adjacencyOffset[collapse.from]; a < adjacencyOffset[collapse.from + 1]; a++)
+            {
+                for (size_t corner = 0; corner < 3; corner++)
+                {
+                    touched[result[adjacency[a] * 3 + corner]] = true;
+                }
+            }
+
+            remap[collapse.from] = collapse.to;
+            quadrics[collapse.to].add(quadrics[collapse.from]);
+            maximumError = std::max(maximumError, collapse.error);
+            collapsesDone++;
+        }
+
+        if (collapsesDone == 0)
+        {
+            break;
+        }
+
+        size_t writeIndex = 0;
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            const uint32_t a = remap[result[i]];
+            const uint32_t b = remap[result[i + 1]];
+            const uint32_t c = remap[result[i + 2]];
+            if (a != b && b != c && a != c)
+            {
+                result[writeIndex++] = a;
+                result[writeIndex++] = b;
+                result[writeIndex++] = c;
+            }
+        }
+        result.resize(writeIndex);
+    }
+
+    error = static_cast<float>(std::sqrt(maximumError));
+    return result;
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+// Small clusters of consecutive triangles in the index buffer, bounded tightly enough to cull them one by one.
+struct Meshlet
+{
+    uint32_t  firstIndex = 0;
+    uint32_t  indexCount = 0;
+    glm::vec3 center     = glm::vec3(0.0f);
+    float     radius     = 0.0f;
+    glm::vec3 coneAxis   = glm::vec3(0.0f, 0.0f, 1.0f);
+    float     coneCutoff = 1.0f; // sine of the normal cone half angle, 1 disables backface culling
+};
+
+// Splits the triangle list into runs of at most maxVertices unique vertices and maxTriangles triangles,
+// keeping the triangle order so every meshlet stays a contiguous index range.
+inline std::vector<Meshlet> buildMeshlets(const uint32_t* indices, size_t indexCount, const float* positions, size_t positionStride, size_t vertexCount, size_t maxVertices, size_t maxTriangles)
+{
+    auto position = [&](uint32_t vertex)
+    {
+        const float* p = reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + vertex * positionStride);
+        return glm::vec3(p[0], p[1], p[2]);
+    };
+
+    std::vector<Meshlet>  meshlets;
+    std::vector<uint32_t> vertexMeshlet(vertexCount, ~0u);
+    std::vector<uint32_t> meshletVertices;
+
+    auto finishMeshlet = [&](Meshlet& meshlet)
+    {
+        glm::vec3 center(0.0f);
+        for (uint32_t vertex : meshletVertices)
+        {
+            center += position(vertex);
+        }
+        center /= float(meshletVertices.size());
+
+        float radius = 0.0f;
+        for (uint32_t vertex : meshletVertices)
+        {
+            radius = std::max(radius, glm::length(position(vertex) - center));
+        }
+
+        // The cone axis is the average triangle normal, its spread the widest angle to any triangle normal
+        std::vector<glm::vec3> normals;
+        glm::vec3              axis(0.0f);
+        for (uint32_t i = meshlet.firstIndex; i < meshlet.firstIndex + meshlet.indexCount; i += 3)
+        {
+            const glm::vec3 p0 = position(indices[i + 0]);
+            const glm::vec3 normal = glm::cross(position(indices[i + 1]) - p0, position(indices[i + 2]) - p0);
+            const float     area   = glm::length(normal);
+            if (area > 0.0f)
+            {
+                normals.push_back(normal / area);
+                axis += normal / area;
+            }
+        }
+
+        meshlet.center     = center;
+        meshlet.radius     = radius;
+        meshlet.coneCutoff = 1.0f;
+
+        const float axisLength = glm::length(axis);
+        if (axisLength > 0.0f)
+        {
+            axis /= axisLength;
+            float minimumDot = 1.0f;
+            for (const glm::vec3& normal : normals)
+            {
+                minimumDot = std::min(minimumDot, glm::dot(axis, normal));
+            }
+
+            meshlet.coneAxis = axis;
+            if (minimumDot > 0.0f)
+            {
+                meshlet.coneCutoff = std::sqrt(1.0f - minimumDot * minimumDot);
+            }
+        }
+
+        meshlets.push_back(meshlet);
+        meshletVertices.clear();
+    };
+
+    Meshlet current;
+    for (size_t i = 0; i + 2 < indexCount; i += 3)
+    {
+        const uint32_t meshletId = static_cast<uint32_t>(meshlets.size());
+
+        size_t newVertices = 0;
+        for (size_t corner = 0; corner < 3; corner++)
+        {
+            newVertices += vertexMeshlet[indices[i + corner]] != meshletId;
+        }
+        // A triangle repeating a vertex would count it twice, which only makes the limit slightly conservative
+        if (current.indexCount > 0 && (meshletVertices.size() + newVertices > maxVertices || current.indexCount / 3 + 1 > maxTriangles))
+        {
+            finishMeshlet(current);
+            current            = Meshlet();
+            current.firstIndex = static_cast<uint32_t>(i);
+        }
+
+        for (size_t corner = 0; corner < 3; corner++)
+        {
+            const uint32_t vertex = indices[i + corner];
+            if (vertexMeshlet[vertex] != meshlets.size())
+            {
+                vertexMeshlet[vertex] = static_cast<uint32_t>(meshlets.size());
+                meshletVertices.push_back(vertex);
+            }
+        }
+        current.indexCount += 3;
+    }
+
+    if (current.indexCount > 0)
+    {
+        finishMeshlet(current);
+    }
+    return meshlets;
+}
+
+
+// Clip space planes of a depth [0, 1] projection, normalized so plane distances are in model units.
+struct Frustum
+{
+    glm::vec4 planes[6];
+};
+
+inline Frustum extractFrustum(const glm::mat4& clip)
+{
+    auto row = [&](int i) { return glm::vec4(clip[0][i], clip[1][i], clip[2][i], clip[3][i]); };
+
+    Frustum frustum;
+    frustum.planes[0] = row(3) + row(0);
+    frustum.planes[1] = row(3) - row(0);
+    frustum.planes[2] = row(3) + row(1);
+    frustum.planes[3] = row(3) - row(1);
+    frustum.planes[4] = row(2);
+    frustum.planes[5] = row(3) - row(2);
+
+    for (glm::vec4& plane : frustum.planes)
+    {
+        plane /= glm::length(glm::vec3(plane));
+    }
+    return frustum;
+}
+
+inline bool isSphereInFrustum(const Frustum& frustum, const glm::vec3& center, float radius)
+{
+    for (const glm::vec4& plane : frustum.planes)
+    {
+        if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// True if every triangle of the meshlet faces away from the camera
+inline bool isMeshletBackfacing(const Meshlet& meshlet, const glm::vec3& cameraPosition)
+{
+    if (meshlet.coneCutoff >= 1.0f)
+    {
+        return false;
+    }
+
+    const glm::vec3 direction = meshlet.center - cameraPosition;
+    return glm::dot(direction, meshlet.coneAxis) >= meshlet.coneCutoff * glm::length(direction) + meshlet.radius;
+}
@@ -0,0 +1,318 @@
+#pragma once
+
+#include "threadPool.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MIP_GENERATOR_SSE2 1
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define MIP_GENERATOR_AVX2 1
+#endif
+
+
+// CPU mip chain generation for RGBA8 images. Every level is filtered from the previous one in linear float,
+// separably, in bands of rows spread over a thread pool.
+
+enum class MipFilter
+{
+    Box,
+    Kaiser, // Kaiser windowed sinc, sharper than box at the cost of a wider footprint
+};
+
+struct MipLevelLayout
+{
+    uint32_t width  = 0;
+    uint32_t height = 0;
+    size_t   offset = 0; // in bytes from the start of the chain
+    size_t   size   = 0;
+};
+
+// Levels halve down to 1x1 like vkCmdBlitImage based generation, packed back to back with 16 byte alignment
+inline std::vector<MipLevelLayout> computeMipChainLayout(uint32_t width, uint32_t height, uint32_t levelCount)
+{
+    std::vector<MipLevelLayout> levels(levelCount);
+    size_t offset = 0;
+    for (uint32_t level = 0; level < levelCount; level++)
+    {
+        levels[level].width  = width;
+        levels[level].height = height;
+        levels[level].offset = offset;
+        levels[level].size   = size_t(width) * height * 4;
+        offset               = (offset + levels[level].size + 15) / 16 * 16;
+
+        width  = std::max(1u, width / 2);
+        height = std::max(1u, height / 2);
+    }
+    return levels;
+}
+
+inline size_t mipChainSize(const std::vector<MipLevelLayout>& levels)
+{
+    return levels.empty() ? 0 : levels.back().offset + levels.back().size;
+}
+
+
+namespace mipGeneratorDetail
+{
+    const float KAISER_WIDTH = 3.0f; // filter radius in destination texels
+    const float KAISER_ALPHA = 4.0f;
+
+    inline float besselI0(float x)
+    {
+        float sum  = 1.0f;
+        float term = 1.0f;
+        for (int k = 1; k < 32; k++)
+        {
+            const float factor = x / (2.0f * k);
+            term *= factor * factor;
+            sum  += term;
+            if (term < sum * 1e-8f)
+            {
+                break;
+            }
+        }
+        return sum;
+    }
+
+    inline float kaiser(float t)
+    {
+        const float pi      = 3.14159265358979f;
+        const float x       = t / KAISER_WIDTH;
+        const float sinc    = std::abs(t) < 1e-6f ? 1.0f : std::sin(pi * t) / (pi * t);
+        const float window  = besselI0(KAISER_ALPHA * std::sqrt(std::max(0.0f, 1.0f - x * x))) / besselI0(KAISER_ALPHA);
+        return std::abs(x) < 1.0f ? sinc * window : 0.0f;
+    }
+
+    // Weights of tapCount consecutive, edge clamped source texels for every destination texel along one axis
+    struct FilterTaps
+    {
+        uint32_t              tapCount = 0;
+        std::vector<uint32_t> sources;
+        std::vector<float>    weights;
+    };
+
+    inline FilterTaps computeTaps(uint32_t sourceSize, uint32_t destinationSize, MipFilter filter)
+    {
+        const float scale   = float(sourceSize) / float(destinationSize);
+        const float support = filter == MipFilter::Box ? 0.5f * scale : KAISER_WIDTH * scale;
+
+        FilterTaps taps;
+        taps.tapCount = static_cast<uint32_t>(std::ceil(2.0f * support)) + 1;
+        taps.sources.resize(size_t(destinationSize) * taps.tapCount);
+        taps.weights.resize(size_t(destinationSize) * taps.tapCount);
+
+        for (uint32_t destination = 0; destination < destinationSize; destination++)
+        {
+            const float   center = (destination + 0.5f) * scale;
+            const int64_t first  = static_cast<int64_t>(std::floor(center - support));
+            float         total  = 0.0f;
+
+            for (uint32_t tap = 0; tap < taps.tapCount; tap++)
+            {
+                const int64_t source = first + tap;
+                float         weight;
+                if (filter == MipFilter::Box)
+                {
+                    weight = std::max(0.0f, std::min(float(source + 1), center + support) - std::max(float(source), center - support));
+                }
+                else
+                {
+                    weight = kaiser((source + 0.5f - center) / scale);
+                }
+
+                const size_t slot  = size_t(destination) * taps.tapCount + tap;
+                taps.sources[slot] = static_cast<uint32_t>(std::clamp<int64_t>(source, 0, sourceSize - 1));
+                taps.weights[slot] = weight;
+                total             += weight;
+            }
+
+            for (uint32_t tap = 0; tap < taps.tapCount; tap++)
+            {
+                taps.weights[size_t(destination) * taps.tapCount + tap] /= total;
+            }
+        }
+        return taps;
+    }
+
+    inline float srgbToLinear(float value)
+    {
+        return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+    }
+
+    inline float linearToSrgb(float value)
+    {
+        return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+    }
+
+    // Accumulates weight * source pixel into a float4
+    inline void accumulate(float* result, const float* pixel, float weight)
+    {
+#ifdef MIP_GENERATOR_SSE2
+        _mm_storeu_ps(result, _mm_add_ps(_mm_loadu_ps(result), _mm_mul_ps(_mm_loadu_ps(pixel), _mm_set1_ps(weight))));
+#else
+        for (int channel = 0; channel < 4; channel++)
+        {
+            result[channel] += pixel[channel] * weight;
+        }
+#endif
+    }
+
+    // result[0, count) += row[0, count) * weight
+    inline void accumulateRow(float* result, const float* row, size_t count, float weight)
+    {
+        size_t i = 0;
+#if defined(MIP_GENERATOR_AVX2)
+        const __m256 weights = _mm256_set1_ps(weight);
+        for (; i + 8 <= count; i += 8)
+        {
+            _mm256_storeu_ps(result + i, _mm256_add_ps(_mm256_loadu_ps(result + i), _mm256_mul_ps(_mm256_loadu_ps(row + i), weights)));
+        }
+#elif defined(MIP_GENERATOR_SSE2)
+        const __m128 weights = _mm_set1_ps(weight);
+        for (; i + 4 <= count; i += 4)
+        {
+            _mm_storeu_ps(result + i, _mm_add_ps(_mm_loadu_ps(result + i), _mm_mul_ps(_mm_loadu_ps(row + i), weights)));
+        }
+#endif
+        for (; i < count; i++)
+        {
+            result[i] += row[i] * weight;
+        }
+    }
+
+    // Filters one level into linear float RGBA. sourcePixel(x, y, out) loads one linear source pixel.
+    template<typename SourcePixel>
+    void filterLevel(const MipLevelLayout& source, const MipLevelLayout& destination, MipFilter filter, const SourcePixel& sourcePixel, float* linear, ThreadPool& threadPool)
+    {
+        const FilterTaps horizontal = computeTaps(source.width, destination.width, filter);
+        const FilterTaps vertical   = computeTaps(source.height, destination.height, filter);
+
+        const uint32_t bandHeight = 32;
+        const uint32_t bandCount  = (destination.height + bandHeight - 1) / bandHeight;
+        const size_t   rowFloats  = size_t(destination.width) * 4;
+
+        threadPool.parallelTasks(bandCount, [&](size_t band)
+        {
+            const uint32_t firstRow = static_cast<uint32_t>(band) * bandHeight;
+            const uint32_t endRow   = std::min(destination.height, firstRow + bandHeight);
+
+            // Horizontally filtered copies of every source row this band reads
+            uint32_t firstSource = source.height;
+            uint32_t endSource   = 0;
+            for (size_t slot = size_t(firstRow) * vertical.tapCount; slot < size_t(endRow) * vertical.tapCount; slot++)
+            {
+                firstSource = std::min(firstSource, vertical.sources[slot]);
+                endSource   = std::max(endSource, vertical.sources[slot] + 1);
+            }
+
+            std::vector<float> rows(size_t(endSource - firstSource) * rowFloats, 0.0f);
+            float              pixel[4];
+            for (uint32_t y = firstSource; y < endSource; y++)
+            {
+                float* row = &rows[size_t(y - firstSource) * rowFloats];
+                for (uint32_t x = 0; x < destination.width; x++)
+                {
+                    for (uint32_t tap = 0; tap < horizontal.tapCount; tap++)
+                    {
+                        const size_t slot = size_t(x) * horizontal.tapCount + tap;
+                        sourcePixel(horizontal.sources[slot], y, pixel);
+                        accumulate(row + size_t(x) * 4, pixel, horizontal.weights[slot]);
+                    }
+                }
+            }
+
+            for (uint32_t y = firstRow; y < endRow; y++)
+            {
+                float* result = linear + size_t(y) * rowFloats;
+                std::fill(result, result + rowFloats, 0.0f);
+                for (uint32_t tap = 0; tap < vertical.tapCount; tap++)
+                {
+                    const size_t slot = size_t(y) * vertical.tapCount + tap;
+                    accumulateRow(result, &rows[size_t(vertical.sources[slot] - firstSource) * rowFloats], rowFloats, vertical.weights[slot]);
+                }
+
+                // Negative lobes of the Kaiser filter can ring outside the valid range
+                for (size_t i = 0; i < rowFloats; i++)
+                {
+                    result[i] = std::min(1.0f, std::max(0.0f, result[i]));
+                }
+            }
+        });
+    }
+
+    inline void encodeLevel(const float* linear, uint8_t* destination, size_t pixelCount, bool srgb, ThreadPool& threadPool)
+    {
+        threadPool.parallelFor(pixelCount, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                for (int channel = 0; channel < 4; channel++)
+                {
+                    float value = linear[i * 4 + channel];
+                    if (srgb && channel < 3)
+                    {
+                        value = linearToSrgb(value);
+                    }
+                    destination[i * 4 + channel] = static_cast<uint8_t>(value * 255.0f + 0.5f);
+                }
+            }
+        });
+    }
+}
+
+// Fills levels 1 and up of chain from level0, which has the size of levels[0]. srgb treats the color channels
+// as sRGB encoded and filters them in linear space; alpha is always linear.
+// chain is only written, so it may point into write combined staging memory.
+inline void generateMipChain(const uint8_t* level0, uint8_t* chain, const std::vector<MipLevelLayout>& levels, MipFilter filter, bool srgb, ThreadPool& threadPool)
+{
+    using namespace mipGeneratorDetail;
+
+    if (levels.size() < 2)
+    {
+        return;
+    }
+
+    std::array<float, 256> decode;
+    for (size_t value = 0; value < decode.size(); value++)
+    {
+        decode[value] = srgb ? srgbToLinear(value / 255.0f) : value / 255.0f;
+    }
+
+    std::vector<float> previous;
+    std::vector<float> current(size_t(levels[1].width) * levels[1].height * 4);
+
+    auto loadLevel0 = [&](uint32_t x, uint32_t y, float* pixel)
+    {
+        const uint8_t* source = level0 + (size_t(y) * levels[0].width + x) * 4;
+        pixel[0] = decode[source[0]];
+        pixel[1] = decode[source[1]];
+        pixel[2] = decode[source[2]];
+        pixel[3] = source[3] / 255.0f;
+    };
+    filterLevel(levels[0], levels[1], filter, loadLevel0, current.data(), threadPool);
+    encodeLevel(current.data(), chain + levels[1].offset, size_t(levels[1].width) * levels[1].height, srgb, threadPool);
+
+    for (size_t level = 2; level < levels.size(); level++)
+    {
+        previous.swap(current);
+        current.assign(size_t(levels[level].width) * levels[level].height * 4, 0.0f);
+
+        const uint32_t previousWidth = levels[level - 1].width;
+        auto loadPrevious = [&](uint32_t x, uint32_t y, float* pixel)
+        {
+            memcpy(pixel, &previous[(size_t(y) * previousWidth + x) * 4], 4 * sizeof(float));
+        };
+        filterLevel(levels[level - 1], levels[level], filter, loadPrevious, current.data(), threadPool);
+        encodeLevel(current.data(), chain + levels[level].offset, size_t(levels[level].width) * levels[level].height, srgb, threadPool);
+    }
+}
@@ -0,0 +1,901 @@
+#pragma once
+
+#include "deviceAllocator.h"
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+// The frame described as passes in execution order, each declaring the images it reads and writes.
+// compile() culls the passes nothing visible depends on, creates a render pass and framebuffers for each
+// remaining pass and the images the graph owns, and lets owned images whose lifetimes do not overlap share
+// memory. execute() records the passes with one merged barrier in front of each, covering exactly the layout
+// changes and hazards between consecutive uses of an image. Imported images, like the swap chain, enter the
+// frame with undefined contents and leave it in their final layout. resize() keeps the render passes, so
+// pipelines created against them stay valid, and only rebuilds what depends on the extent.
+
+// Stages and accesses of an image used in a layout, also for transitions outside the graph
+struct ImageLayoutAccess
+{
+    VkPipelineStageFlags stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    VkAccessFlags        access = 0;
+};
+
+inline ImageLayoutAccess imageLayoutAccess(VkImageLayout layout)
+{
+    switch (layout)
+    {
+    case VK_IMAGE_LAYOUT_UNDEFINED:
+        return {VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0};
+    case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+        return {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT};
+    case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+        return {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT};
+    case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+        return {VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT};
+    case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
+        return {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT};
+    case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
+        return {VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT};
+    case VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL:
+        return {VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_SHADER_READ_BIT};
+    case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR:
+        return {VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0};
+    default:
+        throw std::invalid_argument("unsupported image layout!");
+    }
+}
+
+inline bool isDepthFormat(VkFormat format)
+{
+    return format == VK_FORMAT_D16_UNORM || format == VK_FORMAT_D32_SFLOAT || format == VK_FORMAT_D16_UNORM_S8_UINT ||
+           format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+}
+
+inline VkImageAspectFlags barrierAspectMask(VkFormat format)
+{
+    if (format == VK_FORMAT_D16_UNORM_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_D32_SFLOAT_S8_UINT)
+    {
+        return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+    }
+    return isDepthFormat(format) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+}
+
+struct RenderGraphContext
+{
+    VkCommandBuffer commandBuffer    = VK_NULL_HANDLE;
+    VkRenderPass    renderPass       = VK_NULL_HANDLE;
+    VkFramebuffer   framebuffer      = VK_NULL_HANDLE;
+    uint32_t        framebufferIndex = 0; // which view of the imported images is bound
+};
+
+struct RenderGraphStats
+{
+    uint32_t     passCount         = 0;
+    uint32_t     culledPassCount   = 0;
+    uint32_t     imageCount        = 0; // owned by the graph
+    uint32_t     barrierCount      = 0; // image barriers per frame
+    uint32_t     barrierBatchCount = 0; // vkCmdPipelineBarrier calls per frame
+    VkDeviceSize imageBytes        = 0; // owned images on their own
+    VkDeviceSize memoryBytes       = 0; // after aliasing
+    bool         lazilyAllocated   = false;
+};
+
+class RenderGraph
+{
+public:
+    using Record = std::function<void(const RenderGraphContext& context)>;
+    using Retire = std::function<void(std::function<void()> destroy)>;
+
+    // Owned images are attachments only read within the frame, so they prefer transientMemory
+    RenderGraph(VkDevice device, DeviceAllocator& allocator, VkMemoryPropertyFlags transientMemory)
+        : device(device)
+        , allocator(allocator)
+        , transientMemory(transientMemory)
+    {
+    }
+
+    ~RenderGraph()
+    {
+        SizeDependent old = takeSizeDependent();
+        destroy(device, allocator, old);
+        for (Pass& pass : passes)
+        {
+            vkDestroyRenderPass(device, pass.renderPass, nullptr);
+        }
+    }
+
+    RenderGraph(const RenderGraph&)            = delete;
+    RenderGraph& operator=(const RenderGraph&) = delete;
+
+    uint32_t createImage(const std::string& name, VkFormat format, VkSampleCountFlagBits samples)
+    {
+        Image image;
+        image.name    = name;
+        image.format  = format;
+        image.samples = samples;
+        images.push_back(image);
+        return static_cast<uint32_t>(images.size() - 1);
+    }
+
+    // One image and view per framebuffer index, left in finalLayout at the end of the frame
+    uint32_t importImage(const std::string& name, VkFormat format, VkImageLayout finalLayout, const std::vector<VkImage>& perFramebuffer, const std::vector<VkImageView>& views)
+    {
+        Image image;
+        image.name           = name;
+        image.format         = format;
+        image.imported       = true;
+        image.finalLayout    = finalLayout;
+        image.importedImages = perFramebuffer;
+        image.importedViews  = views;
+        images.push_back(image);
+        return static_cast<uint32_t>(images.size() - 1);
+    }
+
+    // contents tells whether record() draws inline or executes secondary command buffers
+    uint32_t addPass(const std::string& name, VkSubpassContents contents, Record record)
+    {
+        Pass pass;
+        pass.name     = name;
+        pass.contents = contents;
+        pass.record   = std::move(record);
+        passes.push_back(std::move(pass));
+        return static_cast<uint32_t>(passes.size() - 1);
+    }
+
+    void writeColor(uint32_t pass, uint32_t image)
+    {
+        addUse(pass, image, Use::Color, false, {});
+    }
+
+    void clearColor(uint32_t pass, uint32_t image, VkClearColorValue value)
+    {
+        VkClearValue clear;
+        clear.color = value;
+        addUse(pass, image, Use::Color, true, clear);
+    }
+
+    void writeDepth(uint32_t pass, uint32_t image)
+    {
+        addUse(pass, image, Use::Depth, false, {});
+    }
+
+    void clearDepth(uint32_t pass, uint32_t image, VkClearDepthStencilValue value)
+    {
+        VkClearValue clear;
+        clear.depthStencil = value;
+        addUse(pass, image, Use::Depth, true, clear);
+    }
+
+    void readDepth(uint32_t pass, uint32_t image)
+    {
+        addUse(pass, image, Use::DepthRead, false, {});
+    }
+
+    // Resolves the n-th color attachment of the pass into target, in declaration order
+    void resolve(uint32_t pass, uint32_t target)
+    {
+        addUse(pass, target, Use::Resolve, false, {});
+    }
+
+    void sample(uint32_t pass, uint32_t image)
+    {
+        addUse(pass, image, Use::Sampled, false, {});
+    }
+
+    void compile(VkExtent2D extent)
+    {
+        graphExtent = extent;
+        cullPasses();
+        collectUses();
+        createImages();
+        createRenderPasses();
+        createFramebuffers();
+        planBarriers();
+    }
+
+    // Replaces the images of an import, which takes effect with the next resize()
+    void updateImport(uint32_t image, const std::vector<VkImage>& perFramebuffer, const std::vector<VkImageView>& views)
+    {
+        images[image].importedImages = perFramebuffer;
+        images[image].importedViews  = views;
+    }
+
+    // Recreates the owned images and the framebuffers for a new extent. The old ones go to retire, which has to
+    // destroy them once no submitted frame uses them anymore.
+    void resize(VkExtent2D extent, const Retire& retire)
+    {
+        retire([device = device, allocator = &allocator, old = takeSizeDependent()]() mutable { destroy(device, *allocator, old); });
+
+        graphExtent = extent;
+        createImages();
+        createFramebuffers();
+        planBarriers();
+    }
+
+    // Records every live pass into commandBuffer, outside of any render pass
+    void execute(VkCommandBuffer commandBuffer, uint32_t framebufferIndex)
+    {
+        for (Pass& pass : passes)
+        {
+            if (!pass.live)
+            {
+                continue;
+            }
+            recordBarriers(commandBuffer, pass.barriers, framebufferIndex);
+
+            VkRenderPassBeginInfo renderPassInfo = {};
+            renderPassInfo.sType                 = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+            renderPassInfo.renderPass            = pass.renderPass;
+            renderPassInfo.framebuffer           = pass.framebuffers[framebufferIndex];
+            renderPassInfo.renderArea.offset     = {0, 0};
+            renderPassInfo.renderArea.extent     = graphExtent;
+            renderPassInfo.clearValueCount       = static_cast<uint32_t>(pass.clearValues.size());
+            renderPassInfo.pClearValues          = pass.clearValues.data();
+
+            vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, pass.contents);
+
+            RenderGraphContext context;
+            context.commandBuffer    = commandBuffer;
+            context.renderPass       = pass.renderPass;
+            context.framebuffer      = pass.framebuffers[framebufferIndex];
+            context.framebufferIndex = framebufferIndex;
+            pass.record(context);
+
+            vkCmdEndRenderPass(commandBuffer);
+        }
+        recordBarriers(commandBuffer, finalBarriers, framebufferIndex);
+    }
+
+    VkRenderPass renderPass(uint32_t pass) const
+    {
+        return passes[pass].renderPass;
+    }
+
+    bool isLive(uint32_t pass) const
+    {
+        return passes[pass].live;
+    }
+
+    RenderGraphStats stats() const
+    {
+        RenderGraphStats result;
+        result.passCount       = static_cast<uint32_t>(passes.size());
+        result.lazilyAllocated = !memorySlots.empty();
+        for (const Pass& pass : passes)
+        {
+            result.culledPassCount   += pass.live ? 0 : 1;
+            result.barrierCount      += static_cast<uint32_t>(pass.barriers.barriers.size());
+            result.barrierBatchCount += pass.barriers.barriers.empty() ? 0 : 1;
+        }
+        result.barrierCount      += static_cast<uint32_t>(finalBarriers.barriers.size());
+        result.barrierBatchCount += finalBarriers.barriers.empty() ? 0 : 1;
+
+        for (const Image& image : images)
+        {
+            if (!image.imported && !image.uses.empty())
+            {
+                result.imageCount++;
+                result.imageBytes += image.requirements.size;
+            }
+        }
+        for (const MemorySlot& slot : memorySlots)
+        {
+            result.memoryBytes     += slot.memory.size;
+            result.lazilyAllocated &= (allocator.propertyFlags(slot.memory) & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0;
+        }
+        return result;
+    }
+
+    // Bytes the device actually backs the owned images with, only below memoryBytes for lazily allocated memory
+    VkDeviceSize committedBytes() const
+    {
+        VkDeviceSize committed = 0;
+        for (const MemorySlot& slot : memorySlots)
+        {
+            VkDeviceSize slotCommitted = slot.memory.size;
+            if (allocator.propertyFlags(slot.memory) & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)
+            {
+                vkGetDeviceMemoryCommitment(device, slot.memory.memory, &slotCommitted);
+            }
+            committed += slotCommitted;
+        }
+        return committed;
+    }
+
+private:
+    enum class Use
+    {
+        Color,
+        Depth,
+        DepthRead,
+        Resolve,
+        Sampled,
+    };
+
+    struct ImageUse
+    {
+        uint32_t     image      = 0;
+        Use          use        = Use::Color;
+        bool         clear      = false;
+        VkClearValue clearValue = {};
+    };
+
+    // A use of an image by a live pass, in execution order
+    struct ImageUseRef
+    {
+        uint32_t pass  = 0;
+        Use      use   = Use::Color;
+        bool     clear = false;
+    };
+
+    struct Image
+    {
+        std::string              name;
+        VkFormat                 format            = VK_FORMAT_UNDEFINED;
+        VkSampleCountFlagBits    samples           = VK_SAMPLE_COUNT_1_BIT;
+        bool                     imported          = false;
+        VkImageLayout            finalLayout       = VK_IMAGE_LAYOUT_UNDEFINED;
+        std::vector<VkImage>     importedImages;
+        std::vector<VkImageView> importedViews;
+        VkImage                  image             = VK_NULL_HANDLE;
+        VkImageView              view              = VK_NULL_HANDLE;
+        VkMemoryRequirements     requirements      = {};
+        std::vector<ImageUseRef> uses;               // by live passes
+        int32_t                  memoryPredecessor = -1; // image that used the memory last, itself without aliasing
+    };
+
+    struct PlannedBarrier
+    {
+        uint32_t      image     = 0;
+        VkImageLayout oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkImageLayout newLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkAccessFlags srcAccess = 0;
+        VkAccessFlags dstAccess = 0;
+    };
+
+    struct BarrierBatch
+    {
+        VkPipelineStageFlags        srcStages = 0;
+        VkPipelineStageFlags        dstStages = 0;
+        std::vector<PlannedBarrier> barriers;
+    };
+
+    struct Pass
+    {
+        std::string                name;
+        VkSubpassContents          contents   = VK_SUBPASS_CONTENTS_INLINE;
+        Record                     record;
+        std::vector<ImageUse>      uses;
+        bool                       live       = false;
+        VkRenderPass               renderPass = VK_NULL_HANDLE;
+        std::vector<VkFramebuffer> framebuffers;
+        std::vector<VkClearValue>  clearValues;
+        std::vector<uint32_t>      attachments; // images in attachment order
+        BarrierBatch               barriers;    // in front of the pass
+    };
+
+    struct SizeDependent
+    {
+        std::vector<VkFramebuffer>    framebuffers;
+        std::vector<VkImage>          images;
+        std::vector<VkImageView>      views;
+        std::vector<DeviceAllocation> memory;
+    };
+
+    struct MemorySlot
+    {
+        VkMemoryRequirements  requirements = {};
+        uint32_t              lastPass     = 0;
+        std::vector<uint32_t> images;
+        DeviceAllocation      memory;
+    };
+
+    static VkImageLayout useLayout(Use use)
+    {
+        switch (use)
+        {
+        case Use::Color:
+        case Use::Resolve:
+            return VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        case Use::Depth:
+            return VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        case Use::DepthRead:
+            return VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+        default:
+            return VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        }
+    }
+
+    static bool writes(Use use)
+    {
+        return use == Use::Color || use == Use::Depth || use == Use::Resolve;
+    }
+
+    // Cleared and resolved images do not depend on what was in them before
+    static bool overwrites(const ImageUseRef& use)
+    {
+        return use.clear || use.use == Use::Resolve;
+    }
+
+    static VkAccessFlags writeAccess(VkAccessFlags access)
+    {
+        return access & (VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+    }
+
+    void addUse(uint32_t pass, uint32_t image, Use use, bool clear, VkClearValue clearValue)
+    {
+        ImageUse imageUse;
+        imageUse.image      = image;
+        imageUse.use        = use;
+        imageUse.clear      = clear;
+        imageUse.clearValue = clearValue;
+        passes[pass].uses.push_back(imageUse);
+    }
+
+    // Walks the passes backwards: a pass lives if it writes an image whose current contents are needed later,
+    // which are the imported images at the end of the frame
+    void cullPasses()
+    {
+        std::vector<bool> needed(images.size(), false);
+        for (size_t i = 0; i < images.size(); i++)
+        {
+            needed[i] = images[i].imported;
+        }
+
+        for (size_t p = passes.size(); p-- > 0;)
+        {
+            Pass& pass = passes[p];
+            pass.live  = false;
+            for (const ImageUse& use : pass.uses)
+            {
+                pass.live |= writes(use.use) && needed[use.image];
+            }
+            if (!pass.live)
+            {
+                continue;
+            }
+
+            for (const ImageUse& use : pass.uses)
+            {
+                if (use.clear || use.use == Use::Resolve)
+                {
+                    needed[use.image] = false;
+                }
+            }
+            for (const ImageUse& use : pass.uses)
+            {
+                if (!use.clear && use.use != Use::Resolve)
+                {
+                    needed[use.image] = true;
+                }
+            }
+        }
+    }
+
+    void collectUses()
+    {
+        for (uint32_t p = 0; p < passes.size(); p++)
+        {
+            if (!passes[p].live)
+            {
+                continue;
+            }
+            for (const ImageUse& use : passes[p].uses)
+            {
+                ImageUseRef ref;
+                ref.pass  = p;
+                ref.use   = use.use;
+                ref.clear = use.clear;
+                images[use.image].uses.push_back(ref);
+            }
+        }
+    }
+
+    // Owned images are placed first fit into memory slots whose previous images are done before they start
+    void createImages()
+    {
+        for (uint32_t i = 0; i < images.size(); i++)
+        {
+            Image& image = images[i];
+            if (image.imported || image.uses.empty())
+            {
+                continue;
+            }
+
+            bool sampled = false;
+            for (const ImageUseRef& use : image.uses)
+            {
+                sampled |= use.use == Use::Sampled;
+            }
+
+            VkImageCreateInfo imageInfo = {};
+            imageInfo.sType             = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            imageInfo.imageType         = VK_IMAGE_TYPE_2D;
+            imageInfo.extent.width      = graphExtent.width;
+            imageInfo.extent.height     = graphExtent.height;
+            imageInfo.extent.depth      = 1;
+            imageInfo.mipLevels         = 1;
+            imageInfo.arrayLayers       = 1;
+            imageInfo.format            = image.format;
+            imageInfo.tiling            = VK_IMAGE_TILING_OPTIMAL;
+            imageInfo.initialLayout     = VK_IMAGE_LAYOUT_UNDEFINED;
+            imageInfo.usage             = isDepthFormat(image.format) ? VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT : VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+            imageInfo.usage            |= sampled ? VK_IMAGE_USAGE_SAMPLED_BIT : VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+            imageInfo.samples           = image.samples;
+            imageInfo.sharingMode       = VK_SHARING_MODE_EXCLUSIVE;
+
+            if (vkCreateImage(device, &imageInfo, nullptr, &image.image) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to create render graph image " + image.name + "!");
+            }
+            vkGetImageMemoryRequirements(device, image.image, &image.requirements);
+
+            const uint32_t firstPass = image.uses.front().pass;
+            MemorySlot*    slot      = nullptr;
+            for (MemorySlot& candidate : memorySlots)
+            {
+                if (candidate.lastPass < firstPass && (candidate.requirements.memoryTypeBits & image.requirements.memoryTypeBits))
+                {
+                    slot = &candidate;
+                    break;
+                }
+            }
+            if (!slot)
+            {
+                memorySlots.emplace_back();
+                slot = &memorySlots.back();
+                slot->requirements.memoryTypeBits = image.requirements.memoryTypeBits;
+            }
+
+            image.memoryPredecessor            = slot->images.empty() ? -1 : static_cast<int32_t>(slot->images.back());
+            slot->requirements.size            = std::max(slot->requirements.size, image.requirements.size);
+            slot->requirements.alignment       = std::max(slot->requirements.alignment, image.requirements.alignment);
+            slot->requirements.memoryTypeBits &= image.requirements.memoryTypeBits;
+            slot->lastPass                     = image.uses.back().pass;
+            slot->images.push_back(i);
+        }
+
+        for (MemorySlot& slot : memorySlots)
+        {
+            // The first image of a slot follows the last one of the previous frame
+            images[slot.images.front()].memoryPredecessor = static_cast<int32_t>(slot.images.back());
+
+            bool transient = true;
+            for (uint32_t i : slot.images)
+            {
+                for (const ImageUseRef& use : images[i].uses)
+                {
+                    transient &= use.use != Use::Sampled;
+                }
+            }
+            VkMemoryPropertyFlags properties = transient ? transientMemory : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+            if (!allocator.hasMemoryType(slot.requirements.memoryTypeBits, properties))
+            {
+                properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+            }
+            slot.memory = allocator.allocate(slot.requirements, properties, ResourceKind::Optimal);
+
+            for (uint32_t i : slot.images)
+            {
+                Image& image = images[i];
+                vkBindImageMemory(device, image.image, slot.memory.memory, slot.memory.offset);
+
+                VkImageViewCreateInfo viewInfo           = {};
+                viewInfo.sType                           = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+                viewInfo.image                           = image.image;
+                viewInfo.viewType                        = VK_IMAGE_VIEW_TYPE_2D;
+                viewInfo.format                          = image.format;
+                viewInfo.subresourceRange.aspectMask     = isDepthFormat(image.format) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+                viewInfo.subresourceRange.baseMipLevel   = 0;
+                viewInfo.subresourceRange.levelCount     = 1;
+                viewInfo.subresourceRange.baseArrayLayer = 0;
+                viewInfo.subresourceRange.layerCount     = 1;
+
+                if (vkCreateImageView(device, &viewInfo, nullptr, &image.view) != VK_SUCCESS)
+                {
+                    throw std::runtime_error("failed to create render graph image view " + image.name + "!");
+                }
+            }
+        }
+    }
+
+    // One subpass per pass, the attachments stay in the layout of their use and the barriers do the transitions.
+    // Contents are only loaded when an earlier pass wrote them and only stored when a later pass or the
+    // presentation needs them.
+    void createRenderPasses()
+    {
+        for (uint32_t p = 0; p < passes.size(); p++)
+        {
+            Pass& pass = passes[p];
+            if (!pass.live)
+            {
+                continue;
+            }
+
+            std::vector<VkAttachmentDescription> attachments;
+            std::vector<VkAttachmentReference>   colorReferences;
+            std::vector<VkAttachmentReference>   resolveReferences;
+            VkAttachmentReference                depthReference = {VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED};
+
+            for (const ImageUse& use : pass.uses)
+            {
+                if (use.use == Use::Sampled)
+                {
+                    continue;
+                }
+                const Image&        image  = images[use.image];
+                const VkImageLayout layout = useLayout(use.use);
+
+                bool earlierUse = false, laterUse = image.imported;
+                for (const ImageUseRef& other : image.uses)
+                {
+                    earlierUse |= other.pass < p;
+                    laterUse   |= other.pass > p;
+                }
+
+                VkAttachmentDescription attachment = {};
+                attachment.format                  = image.format;
+                attachment.samples                 = image.imported ? VK_SAMPLE_COUNT_1_BIT : image.samples;
+                attachment.loadOp                  = use.clear ? VK_ATTACHMENT_LOAD_OP_CLEAR : (earlierUse && use.use != Use::Resolve ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_DONT_CARE);
+                attachment.storeOp                 = laterUse ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+                attachment.stencilLoadOp           = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+                attachment.stencilStoreOp          = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+                attachment.initialLayout           = layout;
+                attachment.finalLayout             = layout;
+
+                const VkAttachmentReference reference = {static_cast<uint32_t>(attachments.size()), layout};
+                if (use.use == Use::Color)
+                {
+                    colorReferences.push_back(reference);
+                }
+                else if (use.use == Use::Resolve)
+                {
+                    resolveReferences.push_back(reference);
+                }
+                else
+                {
+                    depthReference = reference;
+                }
+
+                attachments.push_back(attachment);
+                pass.attachments.push_back(use.image);
+                pass.clearValues.push_back(use.clearValue);
+            }
+
+            if (!resolveReferences.empty() && resolveReferences.size() != colorReferences.size())
+            {
+                throw std::invalid_argument("pass " + pass.name + " must resolve every color attachment or none!");
+            }
+
+            VkSubpassDescription subpass    = {};
+            subpass.pipelineBindPoint       = VK_PIPELINE_BIND_POINT_GRAPHICS;
+            subpass.colorAttachmentCount    = static_cast<uint32_t>(colorReferences.size());
+            subpass.pColorAttachments       = colorReferences.data();
+            subpass.pResolveAttachments     = resolveReferences.empty() ? nullptr : resolveReferences.data();
+            subpass.pDepthStencilAttachment = depthReference.attachment == VK_ATTACHMENT_UNUSED ? nullptr : &depthReference;
+
+            VkRenderPassCreateInfo renderPassInfo = {};
+            renderPassInfo.sType                  = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+            renderPassInfo.attachmentCount        = static_cast<uint32_t>(attachments.size());
+            renderPassInfo.pAttachments           = attachments.data();
+            renderPassInfo.subpassCount           = 1;
+            renderPassInfo.pSubpasses             = &subpass;
+
+            if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &pass.renderPass) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to create render pass " + pass.name + "!");
+            }
+        }
+    }
+
+    // One framebuffer per view of the imported attachments
+    void createFramebuffers()
+    {
+        for (Pass& pass : passes)
+        {
+            if (!pass.live)
+            {
+                continue;
+            }
+
+            size_t framebufferCount = 1;
+            for (uint32_t image : pass.attachments)
+            {
+                framebufferCount = std::max(framebufferCount, images[image].importedViews.size());
+            }
+
+            pass.framebuffers.resize(framebufferCount);
+            for (size_t f = 0; f < framebufferCount; f++)
+            {
+                std::vector<VkImageView> views;
+                for (uint32_t image : pass.attachments)
+                {
+                    views.push_back(images[image].imported ? images[image].importedViews[f] : images[image].view);
+                }
+
+                VkFramebufferCreateInfo framebufferInfo = {};
+                framebufferInfo.sType                   = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+                framebufferInfo.renderPass              = pass.renderPass;
+                framebufferInfo.attachmentCount         = static_cast<uint32_t>(views.size());
+                framebufferInfo.pAttachments            = views.data();
+                framebufferInfo.width                   = graphExtent.width;
+                framebufferInfo.height                  = graphExtent.height;
+                framebufferInfo.layers                  = 1;
+
+                if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &pass.framebuffers[f]) != VK_SUCCESS)
+                {
+                    throw std::runtime_error("failed to create framebuffer for pass " + pass.name + "!");
+                }
+            }
+        }
+    }
+
+    // Consecutive uses of an image need a barrier when the layout changes or either of them writes. The first
+    // use of the frame starts from undefined contents and waits for whoever used the memory last: the previous
+    // image in the same memory, or the image itself in the previous frame. Imported images wait at the stage of
+    // their first use, which is where the submission waits for them to be acquired.
+    void planBarriers()
+    {
+        for (uint32_t i = 0; i < images.size(); i++)
+        {
+            const Image& image = images[i];
+            for (size_t u = 0; u < image.uses.size(); u++)
+            {
+                const ImageUseRef&      use       = image.uses[u];
+                const VkImageLayout     layout    = useLayout(use.use);
+                const ImageLayoutAccess access    = imageLayoutAccess(layout);
+                const VkAccessFlags     dstAccess = writes(use.use) ? access.access : (access.access & ~writeAccess(access.access));
+
+                PlannedBarrier barrier;
+                barrier.image     = i;
+                barrier.newLayout = layout;
+                barrier.dstAccess = dstAccess;
+
+                VkPipelineStageFlags srcStages;
+                if (u > 0)
+                {
+                    const ImageUseRef& previous = image.uses[u - 1];
+                    if (useLayout(previous.use) == layout && !writes(previous.use) && !writes(use.use))
+                    {
+                        continue;
+                    }
+                    const ImageLayoutAccess previousAccess = imageLayoutAccess(useLayout(previous.use));
+                    barrier.oldLayout = overwrites(use) ? VK_IMAGE_LAYOUT_UNDEFINED : useLayout(previous.use);
+                    barrier.srcAccess = writes(previous.use) ? writeAccess(previousAccess.access) : 0;
+                    srcStages         = previousAccess.stages;
+                }
+                else if (image.imported)
+                {
+                    srcStages = access.stages;
+                }
+                else
+                {
+                    const Image&            predecessor = images[image.memoryPredecessor];
+                    const ImageLayoutAccess lastAccess  = imageLayoutAccess(useLayout(predecessor.uses.back().use));
+                    barrier.srcAccess = writeAccess(lastAccess.access);
+                    srcStages         = lastAccess.stages;
+                }
+
+                BarrierBatch& batch = passes[use.pass].barriers;
+                batch.srcStages |= srcStages;
+                batch.dstStages |= access.stages;
+                batch.barriers.push_back(barrier);
+            }
+
+            if (image.imported && !image.uses.empty())
+            {
+                const ImageLayoutAccess lastAccess = imageLayoutAccess(useLayout(image.uses.back().use));
+                const ImageLayoutAccess final      = imageLayoutAccess(image.finalLayout);
+
+                PlannedBarrier barrier;
+                barrier.image     = i;
+                barrier.oldLayout = useLayout(image.uses.back().use);
+                barrier.newLayout = image.finalLayout;
+                barrier.srcAccess = writeAccess(lastAccess.access);
+                barrier.dstAccess = final.access;
+
+                finalBarriers.srcStages |= lastAccess.stages;
+                finalBarriers.dstStages |= final.stages;
+                finalBarriers.barriers.push_back(barrier);
+            }
+        }
+    }
+
+    // Moves out everything that depends on the extent and leaves the barrier plan empty
+    SizeDependent takeSizeDependent()
+    {
+        SizeDependent old;
+        for (Pass& pass : passes)
+        {
+            old.framebuffers.insert(old.framebuffers.end(), pass.framebuffers.begin(), pass.framebuffers.end());
+            pass.framebuffers.clear();
+            pass.barriers = BarrierBatch();
+        }
+        finalBarriers = BarrierBatch();
+
+        for (Image& image : images)
+        {
+            if (!image.imported && image.image != VK_NULL_HANDLE)
+            {
+                old.images.push_back(image.image);
+                old.views.push_back(image.view);
+                image.image = VK_NULL_HANDLE;
+                image.view  = VK_NULL_HANDLE;
+            }
+        }
+        for (MemorySlot& slot : memorySlots)
+        {
+            old.memory.push_back(slot.memory);
+        }
+        memorySlots.clear();
+        return old;
+    }
+
+    static void destroy(VkDevice device, DeviceAllocator& allocator, SizeDependent& old)
+    {
+        for (VkFramebuffer framebuffer : old.framebuffers)
+        {
+            vkDestroyFramebuffer(device, framebuffer, nullptr);
+        }
+        for (size_t i = 0; i < old.images.size(); i++)
+        {
+            vkDestroyImageView(device, old.views[i], nullptr);
+            vkDestroyImage(device, old.images[i], nullptr);
+        }
+        for (DeviceAllocation& memory : old.memory)
+        {
+            allocator.free(memory);
+        }
+    }
+
+    void recordBarriers(VkCommandBuffer commandBuffer, const BarrierBatch& batch, uint32_t framebufferIndex)
+    {
+        if (batch.barriers.empty())
+        {
+            return;
+        }
+
+        std::vector<VkImageMemoryBarrier> barriers(batch.barriers.size());
+        for (size_t b = 0; b < batch.barriers.size(); b++)
+        {
+            const PlannedBarrier& planned = batch.barriers[b];
+            const Image&          image   = images[planned.image];
+
+            VkImageMemoryBarrier& barrier           = barriers[b];
+            barrier.sType                           = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barrier.oldLayout                       = planned.oldLayout;
+            barrier.newLayout                       = planned.newLayout;
+            barrier.srcAccessMask                   = planned.srcAccess;
+            barrier.dstAccessMask                   = planned.dstAccess;
+            barrier.srcQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image                           = image.imported ? image.importedImages[framebufferIndex] : image.image;
+            barrier.subresourceRange.aspectMask     = barrierAspectMask(image.format);
+            barrier.subresourceRange.baseMipLevel   = 0;
+            barrier.subresourceRange.levelCount     = 1;
+            barrier.subresourceRange.baseArrayLayer = 0;
+            barrier.subresourceRange.layerCount     = 1;
+        }
+
+        vkCmdPipelineBarrier(commandBuffer, batch.srcStages, batch.dstStages, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+    }
+
+    VkDevice                device;
+    DeviceAllocator&        allocator;
+    VkMemoryPropertyFlags   transientMemory;
+    VkExtent2D              graphExtent = {0, 0};
+    std::vector<Image>      images;
+    std::vector<Pass>       passes;
+    std::vector<MemorySlot> memorySlots;
+    BarrierBatch            finalBarriers; // imported images into their final layouts
+};
@@ -0,0 +1,274 @@
+#pragma once
+
+#include "fileCache.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef HAVE_SHADERC
+#include <shaderc/shaderc.hpp>
+#endif
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+
+enum class ShaderStage : uint32_t
+{
+    Vertex,   // .vert
+    Fragment, // .frag
+};
+
+// Followed by the SPIR-V
+struct ShaderCacheHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t codeSize;
+    uint64_t sourceHash; // of the GLSL source and its stage
+};
+
+const char     SHADER_CACHE_MAGIC[8] = "VTSPIRV";
+const uint32_t SHADER_CACHE_VERSION  = 1; // changes with the compile options
+
+inline bool isShaderSource(const std::string& path)
+{
+    const auto endsWith = [&](const char* extension){ return path.size() > strlen(extension) && path.compare(path.size() - strlen(extension), std::string::npos, extension) == 0; };
+    return endsWith(".vert") || endsWith(".frag");
+}
+
+inline ShaderStage shaderStage(const std::string& path)
+{
+    if (!isShaderSource(path))
+    {
+        throw std::invalid_argument("shader " + path + " is neither .vert nor .frag");
+    }
+    return path.compare(path.size() - 5, std::string::npos, ".vert") == 0 ? ShaderStage::Vertex : ShaderStage::Fragment;
+}
+
+struct CompiledShader
+{
+    std::vector<char> code;
+    bool              cached    = false; // read from the cache file instead of compiled
+    float             compileMs = 0.0f;
+};
+
+// Compiles GLSL to SPIR-V in the executable. The SPIR-V goes to a cache file keyed on the hash of the source,
+// so a source only compiles again once it changed. Without shaderc every compile throws.
+// Compiles may come from several threads, they take turns.
+class ShaderCompiler
+{
+public:
+    static bool available()
+    {
+#ifdef HAVE_SHADERC
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Throws with the messages of the compiler. A cache file that cannot be written only costs the compile next time.
+    CompiledShader compile(const std::string& sourcePath, const std::string& cachePath)
+    {
+        const auto start = std::chrono::high_resolution_clock::now();
+
+        // Read instead of mapped, an editor may truncate the file while it is open
+        std::ifstream file(sourcePath, std::ios::binary);
+        if (!file.is_open())
+        {
+            throw std::runtime_error("failed to open shader " + sourcePath + "!");
+        }
+        const std::string source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        const ShaderStage stage = shaderStage(sourcePath);
+        const uint64_t    hash  = hashBytes(source.data(), source.size(), static_cast<uint64_t>(stage));
+
+        CompiledShader shader;
+        shader.cached = readCache(cachePath, hash, shader.code);
+        if (!shader.cached)
+        {
+            shader.code = compileGlsl(sourcePath, source, stage);
+            writeCache(cachePath, hash, shader.code);
+        }
+        shader.compileMs = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+        return shader;
+    }
+
+private:
+    static bool readCache(const std::string& cachePath, uint64_t sourceHash, std::vector<char>& code)
+    {
+        MappedFile cache;
+        if (!cache.open(cachePath) || cache.size() < sizeof(ShaderCacheHeader))
+        {
+            return false;
+        }
+
+        ShaderCacheHeader header;
+        memcpy(&header, cache.data(), sizeof(header));
+
+        bool isValid = memcmp(header.magic, SHADER_CACHE_MAGIC, sizeof(header.magic)) == 0;
+        isValid = isValid && header.version == SHADER_CACHE_VERSION;
+        isValid = isValid && header.sourceHash == sourceHash;
+        isValid = isValid && header.codeSize > 0 && header.codeSize % 4 == 0;
+        isValid = isValid && cache.size() == sizeof(header) + header.codeSize;
+        if (!isValid)
+        {
+            return false;
+        }
+
+        const char* data = reinterpret_cast<const char*>(cache.data()) + sizeof(header);
+        code.assign(data, data + header.codeSize);
+        return true;
+    }
+
+    static bool writeCache(const std::string& cachePath, uint64_t sourceHash, const std::vector<char>& code)
+    {
+        ShaderCacheHeader header = {};
+        memcpy(header.magic, SHADER_CACHE_MAGIC, sizeof(header.magic));
+        header.version    = SHADER_CACHE_VERSION;
+        header.codeSize   = static_cast<uint32_t>(code.size());
+        header.sourceHash = sourceHash;
+
+        return writeFileAtomically(cachePath, [&](std::ofstream& file)
+        {
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(code.data(), code.size());
+        });
+    }
+
+#ifdef HAVE_SHADERC
+    std::vector<char> compileGlsl(const std::string& sourcePath, const std::string& source, ShaderStage stage)
+    {
+        shaderc::CompileOptions options;
+        options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_0);
+        options.SetOptimizationLevel(shaderc_optimization_level_performance);
+
+        const shaderc_shader_kind kind = stage == ShaderStage::Vertex ? shaderc_glsl_vertex_shader : shaderc_glsl_fragment_shader;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        const shaderc::SpvCompilationResult result = compiler.CompileGlslToSpv(source, kind, sourcePath.c_str(), options);
+        if (result.GetCompilationStatus() != shaderc_compilation_status_success)
+        {
+            throw std::runtime_error("failed to compile shader " + sourcePath + ":\n" + result.GetErrorMessage());
+        }
+
+        const std::vector<uint32_t> words(result.cbegin(), result.cend());
+        const char*                 bytes = reinterpret_cast<const char*>(words.data());
+        return std::vector<char>(bytes, bytes + words.size() * sizeof(uint32_t));
+    }
+
+    shaderc::Compiler compiler;
+    std::mutex        mutex;
+#else
+    std::vector<char> compileGlsl(const std::string& sourcePath, const std::string&, ShaderStage)
+    {
+        throw std::runtime_error("failed to compile shader " + sourcePath + ", built without shaderc!");
+    }
+#endif
+};
+
+// Calls changed on a thread of its own for every shader source in a directory that was written. Editors that
+// save to a temporary file and rename it over the source are seen as well. Watching uses inotify, elsewhere
+// isWatching() is false and nothing is ever reported.
+class ShaderWatcher
+{
+public:
+    using Changed = std::function<void(const std::string& path)>;
+
+    ShaderWatcher(const std::string& directory, Changed changed)
+        : directory(directory)
+        , changed(std::move(changed))
+    {
+#ifdef __linux__
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd >= 0 && inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) >= 0)
+        {
+            watcher = std::thread([this]{ watch(); });
+        }
+#endif
+    }
+
+    ~ShaderWatcher()
+    {
+        stopping = true;
+        if (watcher.joinable())
+        {
+            watcher.join();
+        }
+#ifdef __linux__
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+#endif
+    }
+
+    ShaderWatcher(const ShaderWatcher&)            = delete;
+    ShaderWatcher& operator=(const ShaderWatcher&) = delete;
+
+    bool isWatching() const
+    {
+        return watcher.joinable();
+    }
+
+private:
+#ifdef __linux__
+    // Polls with a timeout to notice stopping. A single save raises several events, so every source is reported
+    // once per round.
+    void watch()
+    {
+        alignas(inotify_event) char buffer[4096];
+        while (!stopping)
+        {
+            pollfd descriptor = {fd, POLLIN, 0};
+            if (poll(&descriptor, 1, 100) <= 0)
+            {
+                continue;
+            }
+
+            std::set<std::string> paths;
+            ssize_t               length;
+            while ((length = read(fd, buffer, sizeof(buffer))) > 0)
+            {
+                for (ssize_t offset = 0; offset < length;)
+                {
+                    const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+                    if (event->len > 0 && isShaderSource(event->name))
+                    {
+                        paths.insert(directory + "/" + event->name);
+                    }
+                    offset += sizeof(inotify_event) + event->len;
+                }
+            }
+
+            for (const std::string& path : paths)
+            {
+                changed(path);
+            }
+        }
+    }
+
+    int fd = -1;
+#endif
+
+    std::string       directory;
+    Changed           changed;
+    std::thread       watcher;
+    std::atomic<bool> stopping{false};
+};
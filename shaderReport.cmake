@@ -0,0 +1,32 @@
+# Prints the size and instruction count of a shader before and after spirv-opt, run by the shaders target:
+# cmake -DSHADER=<source> -DUNOPTIMIZED=<spv> -DOPTIMIZED=<spv> [-DSPIRV_DIS=<spirv-dis>] -P shaderReport.cmake
+
+function(spirv_size file result)
+    file(READ "${file}" contents HEX)
+    string(LENGTH "${contents}" digits)
+    math(EXPR bytes "${digits} / 2")
+    set(${result} ${bytes} PARENT_SCOPE)
+endfunction()
+
+# One instruction per line of the disassembly
+function(spirv_instructions file result)
+    execute_process(COMMAND "${SPIRV_DIS}" --no-header "${file}" OUTPUT_VARIABLE disassembly RESULT_VARIABLE failed)
+    if(failed)
+        message(FATAL_ERROR "failed to disassemble ${file}")
+    endif()
+    string(REGEX MATCHALL "[^\n]+" lines "${disassembly}")
+    list(LENGTH lines count)
+    set(${result} ${count} PARENT_SCOPE)
+endfunction()
+
+spirv_size("${UNOPTIMIZED}" unoptimized_size)
+spirv_size("${OPTIMIZED}" optimized_size)
+set(report "${SHADER}: ${unoptimized_size} -> ${optimized_size} bytes")
+
+if(SPIRV_DIS)
+    spirv_instructions("${UNOPTIMIZED}" unoptimized_instructions)
+    spirv_instructions("${OPTIMIZED}" optimized_instructions)
+    set(report "${report}, ${unoptimized_instructions} -> ${optimized_instructions} instructions")
+endif()
+
+message("${report}")
@@ -10,6 +10,13 @@ layout(binding = 0) uniform UniformBufferObject {
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
+layout(location = 3) in mat4 inInstanceTransform;
+layout(location = 7) in uint inMaterialIndex;
+
+const vec3 materialTints[8] = vec3[](
+    vec3(1.00, 1.00, 1.00), vec3(1.00, 0.75, 0.75), vec3(0.75, 1.00, 0.75), vec3(0.75, 0.75, 1.00),
+    vec3(1.00, 1.00, 0.70), vec3(0.70, 1.00, 1.00), vec3(1.00, 0.70, 1.00), vec3(0.80, 0.80, 0.80)
+);
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
@@ -19,7 +26,7 @@ out gl_PerVertex {
 };
 
 void main() {
-    gl_Position  = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
-    fragColor    = inColor;
+    gl_Position  = ubo.proj * ubo.view * inInstanceTransform * ubo.model * vec4(inPosition, 1.0);
+    fragColor    = inColor * materialTints[inMaterialIndex % 8u];
     fragTexCoord = inTexCoord;
 }
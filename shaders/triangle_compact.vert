@@ -0,0 +1,36 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+} ubo;
+
+// The compact vertex layout drops the color attribute when it is the same for every vertex
+layout(constant_id = 0) const float constantRed   = 1.0;
+layout(constant_id = 1) const float constantGreen = 1.0;
+layout(constant_id = 2) const float constantBlue  = 1.0;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 2) in vec2 inTexCoord;
+layout(location = 3) in mat4 inInstanceTransform;
+layout(location = 7) in uint inMaterialIndex;
+
+const vec3 materialTints[8] = vec3[](
+    vec3(1.00, 1.00, 1.00), vec3(1.00, 0.75, 0.75), vec3(0.75, 1.00, 0.75), vec3(0.75, 0.75, 1.00),
+    vec3(1.00, 1.00, 0.70), vec3(0.70, 1.00, 1.00), vec3(1.00, 0.70, 1.00), vec3(0.80, 0.80, 0.80)
+);
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+void main() {
+    gl_Position  = ubo.proj * ubo.view * inInstanceTransform * ubo.model * vec4(inPosition, 1.0);
+    fragColor    = vec3(constantRed, constantGreen, constantBlue) * materialTints[inMaterialIndex % 8u];
+    fragTexCoord = inTexCoord;
+}
@@ -0,0 +1,310 @@
+#pragma once
+
+#include "deviceAllocator.h"
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+
+// Persistently mapped host visible buffer that upload data is written into front to back, wrapping around at
+// the end. Copies out of it are recorded into one open command buffer, and flush() submits them with a fence
+// that guards the bytes written since the previous flush. Space is only reused once that fence signalled,
+// so uploads never wait for the queue to idle, only for the ring to run full.
+
+struct StagingAllocation
+{
+    VkBuffer     buffer = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    void*        data   = nullptr;
+};
+
+class StagingRing
+{
+public:
+    using Submit = std::function<VkResult(const VkSubmitInfo& submitInfo, VkFence fence)>;
+
+    StagingRing(VkDevice device, DeviceAllocator& allocator, uint32_t queueFamily, VkDeviceSize capacity, Submit submit)
+        : device(device)
+        , allocator(allocator)
+        , ringCapacity(capacity)
+        , submit(std::move(submit))
+    {
+        createBuffer(capacity, ringBuffer, ringMemory);
+
+        VkCommandPoolCreateInfo poolInfo = {};
+        poolInfo.sType                   = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex        = queueFamily;
+        poolInfo.flags                   = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+        if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create staging command pool!");
+        }
+    }
+
+    ~StagingRing()
+    {
+        while (!inFlight.empty())
+        {
+            reclaim(true);
+        }
+        for (const Submission& submission : reusable)
+        {
+            vkDestroyFence(device, submission.fence, nullptr);
+        }
+        if (recording)
+        {
+            vkFreeCommandBuffers(device, commandPool, 1, &pending.commandBuffer);
+        }
+        releaseOversized(pending);
+
+        vkDestroyCommandPool(device, commandPool, nullptr);
+        vkDestroyBuffer(device, ringBuffer, nullptr);
+        allocator.free(ringMemory);
+    }
+
+    StagingRing(const StagingRing&)            = delete;
+    StagingRing& operator=(const StagingRing&) = delete;
+
+    // Space for size bytes the next flush reads from. The copy out of it has to be recorded before the next
+    // allocation, which may flush. Waits for the oldest uploads when the ring is full; uploads larger than
+    // the ring get a buffer of their own, released the same way.
+    StagingAllocation allocate(VkDeviceSize size, VkDeviceSize alignment = 16)
+    {
+        StagingAllocation allocation;
+        if (size > ringCapacity)
+        {
+            OversizedBuffer oversized;
+            createBuffer(size, oversized.buffer, oversized.memory);
+            pending.oversized.push_back(oversized);
+
+            allocation.buffer = oversized.buffer;
+            allocation.data   = oversized.memory.mapped;
+            return allocation;
+        }
+
+        VkDeviceSize offset, consumed;
+        while (!tryAllocate(size, alignment, offset, consumed))
+        {
+            if (pending.bytes > 0)
+            {
+                flush();
+            }
+            reclaim(true);
+        }
+
+        head           = offset + size;
+        usedBytes     += consumed;
+        pending.bytes += consumed;
+
+        allocation.buffer = ringBuffer;
+        allocation.offset = offset;
+        allocation.data   = static_cast<uint8_t*>(ringMemory.mapped) + offset;
+        return allocation;
+    }
+
+    // Commands recorded here run with the next flush, in recording order
+    VkCommandBuffer commandBuffer()
+    {
+        if (!recording)
+        {
+            reclaim(false);
+
+            VkCommandBufferAllocateInfo allocInfo = {};
+            allocInfo.sType                       = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.level                       = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandPool                 = commandPool;
+            allocInfo.commandBufferCount          = 1;
+            vkAllocateCommandBuffers(device, &allocInfo, &pending.commandBuffer);
+
+            VkCommandBufferBeginInfo beginInfo = {};
+            beginInfo.sType                    = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags                    = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            vkBeginCommandBuffer(pending.commandBuffer, &beginInfo);
+            recording = true;
+        }
+        return pending.commandBuffer;
+    }
+
+    // Submits everything recorded so far in one submission, without waiting for it
+    void flush()
+    {
+        if (!recording && pending.bytes == 0 && pending.oversized.empty())
+        {
+            return;
+        }
+        commandBuffer();
+
+        // Transfer writes become visible to every later command on the queue, buffers carry no barriers of their own
+        VkMemoryBarrier barrier = {};
+        barrier.sType           = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask   = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask   = VK_ACCESS_MEMORY_READ_BIT;
+        vkCmdPipelineBarrier(pending.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+        vkEndCommandBuffer(pending.commandBuffer);
+        recording = false;
+
+        pending.fence = acquireFence();
+
+        VkSubmitInfo submitInfo       = {};
+        submitInfo.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers    = &pending.commandBuffer;
+        if (submit(submitInfo, pending.fence) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to submit staging uploads!");
+        }
+
+        inFlight.push_back(pending);
+        pending = Submission();
+        submissionCount++;
+    }
+
+    // Flushes and waits for every upload, for the rare caller that reads the results on the host
+    void finish()
+    {
+        flush();
+        while (!inFlight.empty())
+        {
+            reclaim(true);
+        }
+    }
+
+    VkDeviceSize capacity() const
+    {
+        return ringCapacity;
+    }
+
+    uint64_t submissions() const
+    {
+        return submissionCount;
+    }
+
+private:
+    struct OversizedBuffer
+    {
+        VkBuffer         buffer = VK_NULL_HANDLE;
+        DeviceAllocation memory;
+    };
+
+    struct Submission
+    {
+        VkFence                      fence         = VK_NULL_HANDLE;
+        VkCommandBuffer              commandBuffer = VK_NULL_HANDLE;
+        VkDeviceSize                 bytes         = 0; // ring bytes including padding, released in order
+        std::vector<OversizedBuffer> oversized;
+    };
+
+    void createBuffer(VkDeviceSize size, VkBuffer& buffer, DeviceAllocation& memory)
+    {
+        VkBufferCreateInfo bufferInfo = {};
+        bufferInfo.sType              = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size               = size;
+        bufferInfo.usage              = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        bufferInfo.sharingMode        = VK_SHARING_MODE_EXCLUSIVE;
+
+        if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create staging buffer!");
+        }
+
+        VkMemoryRequirements memRequirements;
+        vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+        memory = allocator.allocate(memRequirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, ResourceKind::Linear);
+        vkBindBufferMemory(device, buffer, memory.memory, memory.offset);
+    }
+
+    // The free bytes run from head to the oldest bytes in use, around the end of the ring
+    bool tryAllocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset, VkDeviceSize& consumed) const
+    {
+        offset = (head + alignment - 1) / alignment * alignment;
+        if (offset + size > ringCapacity)
+        {
+            offset = 0; // the tail end of the ring stays unused until it wraps again
+        }
+        consumed = offset >= head ? offset - head + size : ringCapacity - head + size;
+        return usedBytes + consumed <= ringCapacity;
+    }
+
+    void reclaim(bool wait)
+    {
+        while (!inFlight.empty())
+        {
+            Submission& oldest = inFlight.front();
+            if (wait)
+            {
+                vkWaitForFences(device, 1, &oldest.fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+                wait = false;
+            }
+            else if (vkGetFenceStatus(device, oldest.fence) != VK_SUCCESS)
+            {
+                break;
+            }
+
+            usedBytes -= oldest.bytes;
+            vkFreeCommandBuffers(device, commandPool, 1, &oldest.commandBuffer);
+            releaseOversized(oldest);
+            vkResetFences(device, 1, &oldest.fence);
+            reusable.push_back(oldest);
+            inFlight.pop_front();
+        }
+
+        if (usedBytes == 0 && pending.bytes == 0)
+        {
+            head = 0;
+        }
+    }
+
+    void releaseOversized(Submission& submission)
+    {
+        for (OversizedBuffer& oversized : submission.oversized)
+        {
+            vkDestroyBuffer(device, oversized.buffer, nullptr);
+            allocator.free(oversized.memory);
+        }
+        submission.oversized.clear();
+    }
+
+    VkFence acquireFence()
+    {
+        if (!reusable.empty())
+        {
+            const VkFence fence = reusable.back().fence;
+            reusable.pop_back();
+            return fence;
+        }
+
+        VkFenceCreateInfo fenceInfo = {};
+        fenceInfo.sType             = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+        VkFence fence;
+        if (vkCreateFence(device, &fenceInfo, nullptr, &fence) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create staging fence!");
+        }
+        return fence;
+    }
+
+    VkDevice                 device;
+    DeviceAllocator&         allocator;
+    VkDeviceSize             ringCapacity;
+    Submit                   submit;
+    VkBuffer                 ringBuffer  = VK_NULL_HANDLE;
+    DeviceAllocation         ringMemory;
+    VkCommandPool            commandPool = VK_NULL_HANDLE;
+    VkDeviceSize             head        = 0;
+    VkDeviceSize             usedBytes   = 0; // written and not yet reclaimed, including pending
+    Submission               pending;         // recorded since the last flush
+    bool                     recording   = false;
+    std::deque<Submission>   inFlight;
+    std::vector<Submission>  reusable;        // only their fences are kept
+    uint64_t                 submissionCount = 0;
+};
@@ -0,0 +1,681 @@
+#pragma once
+
+#include "fileCache.h"
+#include "mipGenerator.h"
+#include "threadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+
+// Block compression of RGBA8 images into 4x4 texel blocks the GPU samples directly.
+// BC1 stores opaque RGB in 8 bytes per block, BC7 uses mode 6 (RGBA endpoints with 16 interpolation steps) in 16 bytes.
+
+enum class CompressedFormat : uint32_t
+{
+    BC1,
+    BC7,
+    RGBA8, // decoded texels, only stored in texture files
+};
+
+inline size_t compressedBlockSize(CompressedFormat format)
+{
+    return format == CompressedFormat::BC1 ? 8 : 16;
+}
+
+inline size_t compressedLevelSize(uint32_t width, uint32_t height, CompressedFormat format)
+{
+    if (format == CompressedFormat::RGBA8)
+    {
+        return size_t(width) * height * 4;
+    }
+    return size_t((width + 3) / 4) * ((height + 3) / 4) * compressedBlockSize(format);
+}
+
+
+namespace textureCompressionDetail
+{
+    // Dominant direction of the block colors by power iteration on the covariance matrix, as a unit vector
+    template<int Channels>
+    void principalAxis(const float (*pixels)[4], const float* mean, float* axis)
+    {
+        float covariance[Channels][Channels] = {};
+        for (int i = 0; i < 16; i++)
+        {
+            for (int a = 0; a < Channels; a++)
+            {
+                for (int b = 0; b < Channels; b++)
+                {
+                    covariance[a][b] += (pixels[i][a] - mean[a]) * (pixels[i][b] - mean[b]);
+                }
+            }
+        }
+
+        for (int a = 0; a < Channels; a++)
+        {
+            axis[a] = 1.0f / std::sqrt(float(Channels));
+        }
+        for (int iteration = 0; iteration < 8; iteration++)
+        {
+            float next[Channels] = {};
+            float length         = 0.0f;
+            for (int a = 0; a < Channels; a++)
+            {
+                for (int b = 0; b < Channels; b++)
+                {
+                    next[a] += covariance[a][b] * axis[b];
+                }
+                length += next[a] * next[a];
+            }
+            if (length == 0.0f)
+            {
+                return;
+            }
+            length = std::sqrt(length);
+            for (int a = 0; a < Channels; a++)
+            {
+                axis[a] = next[a] / length;
+            }
+        }
+    }
+
+    // Block colors projected onto their principal axis give the initial endpoints
+    template<int Channels>
+    void boundingEndpoints(const float (*pixels)[4], float* low, float* high)
+    {
+        float mean[Channels] = {};
+        for (int i = 0; i < 16; i++)
+        {
+            for (int a = 0; a < Channels; a++)
+            {
+                mean[a] += pixels[i][a] / 16.0f;
+            }
+        }
+
+        float axis[Channels];
+        principalAxis<Channels>(pixels, mean, axis);
+
+        float minimum = 0.0f;
+        float maximum = 0.0f;
+        for (int i = 0; i < 16; i++)
+        {
+            float projection = 0.0f;
+            for (int a = 0; a < Channels; a++)
+            {
+                projection += (pixels[i][a] - mean[a]) * axis[a];
+            }
+            minimum = std::min(minimum, projection);
+            maximum = std::max(maximum, projection);
+        }
+
+        for (int a = 0; a < Channels; a++)
+        {
+            low[a]  = std::clamp(mean[a] + minimum * axis[a], 0.0f, 255.0f);
+            high[a] = std::clamp(mean[a] + maximum * axis[a], 0.0f, 255.0f);
+        }
+    }
+
+    // Least squares endpoints for fixed indices, weights[i] is the share of the high endpoint in pixel i
+    template<int Channels>
+    bool refineEndpoints(const float (*pixels)[4], const float* weights, float* low, float* high)
+    {
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+        float ax[Channels] = {};
+        float bx[Channels] = {};
+        for (int i = 0; i < 16; i++)
+        {
+            const float b = weights[i];
+            const float a = 1.0f - b;
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            for (int c = 0; c < Channels; c++)
+            {
+                ax[c] += a * pixels[i][c];
+                bx[c] += b * pixels[i][c];
+            }
+        }
+
+        const float determinant = aa * bb - ab * ab;
+        if (std::abs(determinant) < 1e-6f)
+        {
+            return false;
+        }
+        for (int c = 0; c < Channels; c++)
+        {
+            low[c]  = std::clamp((ax[c] * bb - bx[c] * ab) / determinant, 0.0f, 255.0f);
+            high[c] = std::clamp((bx[c] * aa - ax[c] * ab) / determinant, 0.0f, 255.0f);
+        }
+        return true;
+    }
+
+    inline uint16_t packRgb565(const float* color)
+    {
+        const uint32_t r = static_cast<uint32_t>(std::lround(color[0] * 31.0f / 255.0f));
+        const uint32_t g = static_cast<uint32_t>(std::lround(color[1] * 63.0f / 255.0f));
+        const uint32_t b = static_cast<uint32_t>(std::lround(color[2] * 31.0f / 255.0f));
+        return static_cast<uint16_t>(r << 11 | g << 5 | b);
+    }
+
+    inline void unpackRgb565(uint16_t packed, int* color)
+    {
+        const int r = packed >> 11 & 31;
+        const int g = packed >> 5 & 63;
+        const int b = packed & 31;
+        color[0] = r << 3 | r >> 2;
+        color[1] = g << 2 | g >> 4;
+        color[2] = b << 3 | b >> 2;
+    }
+
+    // The four color palette of a BC1 block with color0 > color1
+    inline void bc1Palette(uint16_t color0, uint16_t color1, int (*palette)[3])
+    {
+        unpackRgb565(color0, palette[0]);
+        unpackRgb565(color1, palette[1]);
+        for (int c = 0; c < 3; c++)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+    }
+
+    // Picks the closest palette entry for every pixel and returns the summed squared error
+    inline float bc1Indices(const float (*pixels)[4], uint16_t color0, uint16_t color1, uint32_t& indices)
+    {
+        int palette[4][3];
+        bc1Palette(color0, color1, palette);
+
+        float error = 0.0f;
+        indices     = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            float    best      = 1e30f;
+            uint32_t bestIndex = 0;
+            for (uint32_t entry = 0; entry < 4; entry++)
+            {
+                float distance = 0.0f;
+                for (int c = 0; c < 3; c++)
+                {
+                    const float delta = pixels[i][c] - palette[entry][c];
+                    distance += delta * delta;
+                }
+                if (distance < best)
+                {
+                    best      = distance;
+                    bestIndex = entry;
+                }
+            }
+            indices |= bestIndex << (2 * i);
+            error   += best;
+        }
+        return error;
+    }
+
+    // Orders the endpoints for four color mode; equal endpoints fall back to a solid block
+    inline float bc1Encode(const float (*pixels)[4], const float* low, const float* high, uint16_t& color0, uint16_t& color1, uint32_t& indices)
+    {
+        color0 = packRgb565(high);
+        color1 = packRgb565(low);
+        if (color0 < color1)
+        {
+            std::swap(color0, color1);
+        }
+        if (color0 == color1)
+        {
+            int color[3];
+            unpackRgb565(color0, color);
+            indices     = 0;
+            float error = 0.0f;
+            for (int i = 0; i < 16; i++)
+            {
+                for (int c = 0; c < 3; c++)
+                {
+                    error += (pixels[i][c] - color[c]) * (pixels[i][c] - color[c]);
+                }
+            }
+            return error;
+        }
+        return bc1Indices(pixels, color0, color1, indices);
+    }
+
+    const int BC7_WEIGHTS[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+    struct Bc7Endpoints
+    {
+        int quantized[2][4]; // 7 bits per channel
+        int pBits[2];
+    };
+
+    inline int bc7Expand(int quantized, int pBit)
+    {
+        return quantized << 1 | pBit;
+    }
+
+    inline int bc7Interpolate(int low, int high, int weight)
+    {
+        return ((64 - weight) * low + weight * high + 32) >> 6;
+    }
+
+    inline float bc7Indices(const float (*pixels)[4], const Bc7Endpoints& endpoints, uint8_t* indices)
+    {
+        int palette[16][4];
+        for (int entry = 0; entry < 16; entry++)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                palette[entry][c] = bc7Interpolate(bc7Expand(endpoints.quantized[0][c], endpoints.pBits[0]),
+                                                   bc7Expand(endpoints.quantized[1][c], endpoints.pBits[1]), BC7_WEIGHTS[entry]);
+            }
+        }
+
+        float error = 0.0f;
+        for (int i = 0; i < 16; i++)
+        {
+            float best = 1e30f;
+            for (int entry = 0; entry < 16; entry++)
+            {
+                float distance = 0.0f;
+                for (int c = 0; c < 4; c++)
+                {
+                    const float delta = pixels[i][c] - palette[entry][c];
+                    distance += delta * delta;
+                }
+                if (distance < best)
+                {
+                    best       = distance;
+                    indices[i] = static_cast<uint8_t>(entry);
+                }
+            }
+            error += best;
+        }
+        return error;
+    }
+
+    // Tries all four p-bit combinations for the endpoints and keeps the one with the lowest error
+    inline float bc7Encode(const float (*pixels)[4], const float* low, const float* high, Bc7Endpoints& endpoints, uint8_t* indices)
+    {
+        float bestError = 1e30f;
+        for (int combination = 0; combination < 4; combination++)
+        {
+            Bc7Endpoints candidate;
+            candidate.pBits[0] = combination & 1;
+            candidate.pBits[1] = combination >> 1;
+            for (int c = 0; c < 4; c++)
+            {
+                candidate.quantized[0][c] = std::clamp(static_cast<int>(std::lround((low[c] - candidate.pBits[0]) / 2.0f)), 0, 127);
+                candidate.quantized[1][c] = std::clamp(static_cast<int>(std::lround((high[c] - candidate.pBits[1]) / 2.0f)), 0, 127);
+            }
+
+            uint8_t candidateIndices[16];
+            const float error = bc7Indices(pixels, candidate, candidateIndices);
+            if (error < bestError)
+            {
+                bestError = error;
+                endpoints = candidate;
+                memcpy(indices, candidateIndices, 16);
+            }
+        }
+        return bestError;
+    }
+
+    class BitWriter
+    {
+    public:
+        explicit BitWriter(uint8_t* block)
+            : block(block)
+        {
+            memset(block, 0, 16);
+        }
+
+        void write(uint32_t value, int bitCount)
+        {
+            for (int bit = 0; bit < bitCount; bit++, position++)
+            {
+                block[position / 8] |= static_cast<uint8_t>((value >> bit & 1) << (position % 8));
+            }
+        }
+
+    private:
+        uint8_t* block;
+        int      position = 0;
+    };
+
+    class BitReader
+    {
+    public:
+        explicit BitReader(const uint8_t* block)
+            : block(block)
+        {
+        }
+
+        uint32_t read(int bitCount)
+        {
+            uint32_t value = 0;
+            for (int bit = 0; bit < bitCount; bit++, position++)
+            {
+                value |= uint32_t(block[position / 8] >> (position % 8) & 1) << bit;
+            }
+            return value;
+        }
+
+    private:
+        const uint8_t* block;
+        int            position = 0;
+    };
+}
+
+// Encodes one 4x4 block of RGBA8 texels in row order, alpha is ignored
+inline void encodeBC1Block(const uint8_t* texels, uint8_t* block)
+{
+    using namespace textureCompressionDetail;
+
+    float pixels[16][4];
+    for (int i = 0; i < 16; i++)
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            pixels[i][c] = texels[i * 4 + c];
+        }
+    }
+
+    float low[4], high[4];
+    boundingEndpoints<3>(pixels, low, high);
+
+    uint16_t color0, color1;
+    uint32_t indices;
+    float    error = bc1Encode(pixels, low, high, color0, color1, indices);
+
+    // One least squares pass over the chosen indices, kept only if it lowers the error
+    if (color0 != color1)
+    {
+        const float shares[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f}; // share of color1, the low endpoint
+        float       weights[16];
+        for (int i = 0; i < 16; i++)
+        {
+            weights[i] = 1.0f - shares[indices >> (2 * i) & 3];
+        }
+
+        uint16_t refined0, refined1;
+        uint32_t refinedIndices;
+        if (refineEndpoints<3>(pixels, weights, low, high))
+        {
+            const float refinedError = bc1Encode(pixels, low, high, refined0, refined1, refinedIndices);
+            if (refinedError < error)
+            {
+                error   = refinedError;
+                color0  = refined0;
+                color1  = refined1;
+                indices = refinedIndices;
+            }
+        }
+    }
+
+    memcpy(block, &color0, 2);
+    memcpy(block + 2, &color1, 2);
+    memcpy(block + 4, &indices, 4);
+}
+
+// Encodes one 4x4 block of RGBA8 texels in row order with BC7 mode 6
+inline void encodeBC7Block(const uint8_t* texels, uint8_t* block)
+{
+    using namespace textureCompressionDetail;
+
+    float pixels[16][4];
+    for (int i = 0; i < 16; i++)
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            pixels[i][c] = texels[i * 4 + c];
+        }
+    }
+
+    float low[4], high[4];
+    boundingEndpoints<4>(pixels, low, high);
+
+    Bc7Endpoints endpoints;
+    uint8_t      indices[16];
+    const float  error = bc7Encode(pixels, low, high, endpoints, indices);
+
+    float weights[16];
+    for (int i = 0; i < 16; i++)
+    {
+        weights[i] = BC7_WEIGHTS[indices[i]] / 64.0f;
+    }
+    if (refineEndpoints<4>(pixels, weights, low, high))
+    {
+        Bc7Endpoints refined;
+        uint8_t      refinedIndices[16];
+        if (bc7Encode(pixels, low, high, refined, refinedIndices) < error)
+        {
+            endpoints = refined;
+            memcpy(indices, refinedIndices, 16);
+        }
+    }
+
+    // The first index is stored with an implicit zero top bit
+    if (indices[0] & 8)
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            std::swap(endpoints.quantized[0][c], endpoints.quantized[1][c]);
+        }
+        std::swap(endpoints.pBits[0], endpoints.pBits[1]);
+        for (uint8_t& index : indices)
+        {
+            index = static_cast<uint8_t>(15 - index);
+        }
+    }
+
+    BitWriter writer(block);
+    writer.write(1u << 6, 7);
+    for (int c = 0; c < 4; c++)
+    {
+        writer.write(endpoints.quantized[0][c], 7);
+        writer.write(endpoints.quantized[1][c], 7);
+    }
+    writer.write(endpoints.pBits[0], 1);
+    writer.write(endpoints.pBits[1], 1);
+    writer.write(indices[0], 3);
+    for (int i = 1; i < 16; i++)
+    {
+        writer.write(indices[i], 4);
+    }
+}
+
+inline void decodeBC1Block(const uint8_t* block, uint8_t* texels)
+{
+    using namespace textureCompressionDetail;
+
+    uint16_t color0, color1;
+    uint32_t indices;
+    memcpy(&color0, block, 2);
+    memcpy(&color1, block + 2, 2);
+    memcpy(&indices, block + 4, 4);
+
+    int palette[4][3];
+    bc1Palette(color0, color1, palette);
+    if (color0 <= color1)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = 0;
+        }
+    }
+
+    for (int i = 0; i < 16; i++)
+    {
+        const int entry = indices >> (2 * i) & 3;
+        for (int c = 0; c < 3; c++)
+        {
+            texels[i * 4 + c] = static_cast<uint8_t>(palette[entry][c]);
+        }
+        texels[i * 4 + 3] = 255;
+    }
+}
+
+// Decodes blocks written by encodeBC7Block; other BC7 modes decode to zero
+inline void decodeBC7Block(const uint8_t* block, uint8_t* texels)
+{
+    using namespace textureCompressionDetail;
+
+    BitReader reader(block);
+    if (reader.read(7) != 1u << 6)
+    {
+        memset(texels, 0, 64);
+        return;
+    }
+
+    Bc7Endpoints endpoints;
+    for (int c = 0; c < 4; c++)
+    {
+        endpoints.quantized[0][c] = static_cast<int>(reader.read(7));
+        endpoints.quantized[1][c] = static_cast<int>(reader.read(7));
+    }
+    endpoints.pBits[0] = static_cast<int>(reader.read(1));
+    endpoints.pBits[1] = static_cast<int>(reader.read(1));
+
+    for (int i = 0; i < 16; i++)
+    {
+        const int index = static_cast<int>(reader.read(i == 0 ? 3 : 4));
+        for (int c = 0; c < 4; c++)
+        {
+            texels[i * 4 + c] = static_cast<uint8_t>(bc7Interpolate(bc7Expand(endpoints.quantized[0][c], endpoints.pBits[0]),
+                                                                    bc7Expand(endpoints.quantized[1][c], endpoints.pBits[1]), BC7_WEIGHTS[index]));
+        }
+    }
+}
+
+// Compresses a whole RGBA8 image, rows of blocks are spread over the thread pool.
+// Partial blocks at the right and bottom edge repeat the last texel.
+inline void compressImage(const uint8_t* rgba, uint32_t width, uint32_t height, CompressedFormat format, uint8_t* destination, ThreadPool& threadPool)
+{
+    const uint32_t blocksX   = (width + 3) / 4;
+    const uint32_t blocksY   = (height + 3) / 4;
+    const size_t   blockSize = compressedBlockSize(format);
+
+    threadPool.parallelFor(blocksY, [&](size_t begin, size_t end)
+    {
+        uint8_t texels[64];
+        for (size_t blockY = begin; blockY < end; blockY++)
+        {
+            for (uint32_t blockX = 0; blockX < blocksX; blockX++)
+            {
+                for (uint32_t y = 0; y < 4; y++)
+                {
+                    for (uint32_t x = 0; x < 4; x++)
+                    {
+                        const uint32_t sourceX = std::min(width - 1, blockX * 4 + x);
+                        const uint32_t sourceY = std::min(height - 1, static_cast<uint32_t>(blockY) * 4 + y);
+                        memcpy(&texels[(y * 4 + x) * 4], &rgba[(size_t(sourceY) * width + sourceX) * 4], 4);
+                    }
+                }
+
+                uint8_t* block = destination + (blockY * blocksX + blockX) * blockSize;
+                if (format == CompressedFormat::BC1)
+                {
+                    encodeBC1Block(texels, block);
+                }
+                else
+                {
+                    encodeBC7Block(texels, block);
+                }
+            }
+        }
+    });
+}
+
+
+// Container for a mip chain in any CompressedFormat, modelled on KTX2: the header, one CompressedTextureLevel
+// per level, then the level data. Both the encoder output and the decoded texture cache use it.
+struct CompressedTextureHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t format; // CompressedFormat
+    uint32_t width;
+    uint32_t height;
+    uint32_t levelCount;
+    uint32_t mipFilter;  // MipFilter that produced levels 1 and up
+    uint64_t sourceHash; // hashBytes of the source image file
+};
+
+struct CompressedTextureLevel
+{
+    uint64_t offset; // in bytes from the start of the file
+    uint64_t size;
+    uint32_t width;
+    uint32_t height;
+};
+
+const char     COMPRESSED_TEXTURE_MAGIC[8] = "VTTEX";
+const uint32_t COMPRESSED_TEXTURE_VERSION  = 2;
+
+// Checks a mapped container and returns its level table, or nullptr if the file is truncated or from another version
+inline const CompressedTextureLevel* parseCompressedTexture(const uint8_t* data, size_t size, CompressedTextureHeader& header)
+{
+    if (size < sizeof(CompressedTextureHeader))
+    {
+        return nullptr;
+    }
+    memcpy(&header, data, sizeof(header));
+
+    bool isValid = true;
+    isValid &= memcmp(header.magic, COMPRESSED_TEXTURE_MAGIC, sizeof(header.magic)) == 0;
+    isValid &= header.version == COMPRESSED_TEXTURE_VERSION;
+    isValid &= header.format <= static_cast<uint32_t>(CompressedFormat::RGBA8);
+    isValid &= header.levelCount > 0 && sizeof(header) + uint64_t(header.levelCount) * sizeof(CompressedTextureLevel) <= size;
+    if (!isValid)
+    {
+        return nullptr;
+    }
+
+    const CompressedTextureLevel* levels = reinterpret_cast<const CompressedTextureLevel*>(data + sizeof(header));
+    for (uint32_t level = 0; level < header.levelCount; level++)
+    {
+        const size_t expectedSize = compressedLevelSize(levels[level].width, levels[level].height, static_cast<CompressedFormat>(header.format));
+        if (levels[level].size != expectedSize || levels[level].offset + levels[level].size > size)
+        {
+            return nullptr;
+        }
+    }
+    return levels;
+}
+
+// Lays out levels of the given sizes after the header and level table, starting at a 16 byte boundary
+inline std::vector<CompressedTextureLevel> layoutCompressedTexture(const CompressedTextureHeader& header, const std::vector<MipLevelLayout>& mipLevels)
+{
+    std::vector<CompressedTextureLevel> levels(header.levelCount);
+    uint64_t offset = (sizeof(header) + levels.size() * sizeof(CompressedTextureLevel) + 15) / 16 * 16;
+    for (uint32_t level = 0; level < header.levelCount; level++)
+    {
+        levels[level].offset = offset;
+        levels[level].size   = compressedLevelSize(mipLevels[level].width, mipLevels[level].height, static_cast<CompressedFormat>(header.format));
+        levels[level].width  = mipLevels[level].width;
+        levels[level].height = mipLevels[level].height;
+        offset               = (offset + levels[level].size + 15) / 16 * 16;
+    }
+    return levels;
+}
+
+// Writes the container, data holds the level data as laid out from levels[0].offset on
+inline bool writeCompressedTexture(const std::string& path, const CompressedTextureHeader& header, const std::vector<CompressedTextureLevel>& levels, const uint8_t* data)
+{
+    const uint64_t tableEnd = sizeof(header) + levels.size() * sizeof(CompressedTextureLevel);
+    const uint64_t dataSize = levels.back().offset + levels.back().size - levels[0].offset;
+
+    return writeFileAtomically(path, [&](std::ofstream& file)
+    {
+        const char padding[16] = {};
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(levels.data()), levels.size() * sizeof(CompressedTextureLevel));
+        file.write(padding, levels[0].offset - tableEnd);
+        file.write(reinterpret_cast<const char*>(data), dataSize);
+    });
+}
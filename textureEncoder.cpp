@@ -0,0 +1,198 @@
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include "fileCache.h"
+#include "mipGenerator.h"
+#include "textureCompression.h"
+#include "threadPool.h"
+
+#include <chrono>
+
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <fstream>
+#include <string>
+
+
+// Offline converter from an image file into a block compressed mip chain the viewer uploads without decoding:
+//     textureEncoder <input> <output> [--format=bc1|bc7] [--mip-filter=box|kaiser] [--threads=N]
+
+struct EncoderSettings
+{
+    std::string      input;
+    std::string      output;
+    CompressedFormat format        = CompressedFormat::BC7;
+    MipFilter        mipFilter     = MipFilter::Kaiser;
+    uint32_t         workerThreads = 0;
+};
+
+EncoderSettings parseArguments(int argc, char** argv)
+{
+    EncoderSettings          settings;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string argument  = argv[i];
+        const size_t      separator = argument.find('=');
+        const std::string name      = argument.substr(0, separator);
+        const std::string value     = separator == std::string::npos ? "" : argument.substr(separator + 1);
+
+        if (argument.compare(0, 2, "--") != 0)
+        {
+            paths.push_back(argument);
+        }
+        else if (name == "--format")
+        {
+            if (value != "bc1" && value != "bc7")
+            {
+                throw std::invalid_argument("format must be bc1 or bc7");
+            }
+            settings.format = value == "bc1" ? CompressedFormat::BC1 : CompressedFormat::BC7;
+        }
+        else if (name == "--mip-filter")
+        {
+            if (value != "box" && value != "kaiser")
+            {
+                throw std::invalid_argument("mip filter must be box or kaiser");
+            }
+            settings.mipFilter = value == "box" ? MipFilter::Box : MipFilter::Kaiser;
+        }
+        else if (name == "--threads")
+        {
+            settings.workerThreads = static_cast<uint32_t>(std::stoul(value));
+        }
+        else
+        {
+            throw std::invalid_argument("unknown argument " + argument);
+        }
+    }
+
+    if (paths.size() != 2)
+    {
+        throw std::invalid_argument("usage: textureEncoder <input> <output> [--format=bc1|bc7] [--mip-filter=box|kaiser] [--threads=N]");
+    }
+    settings.input  = paths[0];
+    settings.output = paths[1];
+    return settings;
+}
+
+// Peak signal to noise ratio of the decoded level against its RGBA8 source, over the color channels
+double measurePsnr(const uint8_t* rgba, uint32_t width, uint32_t height, const uint8_t* blocks, CompressedFormat format)
+{
+    const uint32_t blocksX = (width + 3) / 4;
+    const uint32_t blocksY = (height + 3) / 4;
+
+    double  squaredError = 0.0;
+    uint8_t texels[64];
+    for (uint32_t blockY = 0; blockY < blocksY; blockY++)
+    {
+        for (uint32_t blockX = 0; blockX < blocksX; blockX++)
+        {
+            const uint8_t* block = blocks + (size_t(blockY) * blocksX + blockX) * compressedBlockSize(format);
+            if (format == CompressedFormat::BC1)
+            {
+                decodeBC1Block(block, texels);
+            }
+            else
+            {
+                decodeBC7Block(block, texels);
+            }
+
+            for (uint32_t y = 0; y < 4 && blockY * 4 + y < height; y++)
+            {
+                for (uint32_t x = 0; x < 4 && blockX * 4 + x < width; x++)
+                {
+                    for (int c = 0; c < 3; c++)
+                    {
+                        const double delta = double(texels[(y * 4 + x) * 4 + c]) - rgba[((size_t(blockY) * 4 + y) * width + blockX * 4 + x) * 4 + c];
+                        squaredError += delta * delta;
+                    }
+                }
+            }
+        }
+    }
+
+    const double meanSquaredError = squaredError / (double(width) * height * 3);
+    return meanSquaredError > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / meanSquaredError) : 99.0;
+}
+
+void encodeTexture(const EncoderSettings& settings)
+{
+    const auto startTime = std::chrono::high_resolution_clock::now();
+
+    MappedFile source;
+    if (!source.open(settings.input))
+    {
+        throw std::runtime_error("failed to open texture " + settings.input);
+    }
+    const uint64_t sourceHash = hashBytes(source.data(), source.size());
+
+    int texWidth, texHeight, texChannels;
+    stbi_uc* pixels = stbi_load_from_memory(source.data(), static_cast<int>(source.size()), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+    if (!pixels)
+    {
+        throw std::runtime_error("failed to load texture image!");
+    }
+    source.close();
+
+    // Same chain as the viewer builds for RGBA8 textures
+    const uint32_t                    mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
+    const std::vector<MipLevelLayout> layout    = computeMipChainLayout(texWidth, texHeight, mipLevels);
+    std::vector<uint8_t>              chain(mipChainSize(layout));
+    memcpy(chain.data(), pixels, layout[0].size);
+    stbi_image_free(pixels);
+
+    ThreadPool threadPool(settings.workerThreads);
+    generateMipChain(chain.data(), chain.data(), layout, settings.mipFilter, true, threadPool);
+
+    CompressedTextureHeader header = {};
+    memcpy(header.magic, COMPRESSED_TEXTURE_MAGIC, sizeof(header.magic));
+    header.version    = COMPRESSED_TEXTURE_VERSION;
+    header.format     = static_cast<uint32_t>(settings.format);
+    header.width      = static_cast<uint32_t>(texWidth);
+    header.height     = static_cast<uint32_t>(texHeight);
+    header.levelCount = mipLevels;
+    header.mipFilter  = static_cast<uint32_t>(settings.mipFilter);
+    header.sourceHash = sourceHash;
+
+    const std::vector<CompressedTextureLevel> levels = layoutCompressedTexture(header, layout);
+
+    std::vector<uint8_t> blocks(levels.back().offset + levels.back().size - levels[0].offset);
+    for (uint32_t level = 0; level < mipLevels; level++)
+    {
+        compressImage(chain.data() + layout[level].offset, layout[level].width, layout[level].height, settings.format,
+                      blocks.data() + (levels[level].offset - levels[0].offset), threadPool);
+    }
+
+    if (!writeCompressedTexture(settings.output, header, levels, blocks.data()))
+    {
+        throw std::runtime_error("failed to write " + settings.output);
+    }
+
+    const float  totalMs = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - startTime).count();
+    const double psnr    = measurePsnr(chain.data(), layout[0].width, layout[0].height, blocks.data(), settings.format);
+    std::cout << "Encoded " << settings.input << " to " << settings.output << " (" << (settings.format == CompressedFormat::BC1 ? "BC1" : "BC7") << ", "
+              << texWidth << "x" << texHeight << ", " << mipLevels << " levels)" << std::endl;
+    std::cout << "\t" << blocks.size() / 1024 << " KiB instead of " << mipChainSize(layout) / 1024 << " KiB as RGBA8, level 0 PSNR " << psnr << " dB" << std::endl;
+    std::cout << "\ttotal " << totalMs << " ms (" << threadPool.size() << " threads)" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        encodeTexture(parseArguments(argc, argv));
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Fixed set of worker threads executing batches of indexed tasks.
+// The calling thread takes part in every batch, so a pool of size 1 runs everything inline.
+// Batches are not reentrant: a task must not start another batch on the same pool.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(size_t threadCount = 0)
+    {
+        if (threadCount == 0)
+        {
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        for (size_t i = 1; i < threadCount; i++)
+        {
+            workers.emplace_back([this]{ workerLoop(); });
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeWorkers.notify_all();
+
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&)            = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const
+    {
+        return workers.size() + 1;
+    }
+
+    // Runs task(i) for every i in [0, taskCount) and blocks until all of them finished.
+    // The first exception thrown by a task is rethrown on the calling thread.
+    void parallelTasks(size_t taskCount, const std::function<void(size_t)>& task)
+    {
+        if (taskCount == 0)
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> batchLock(batchMutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            batchTask      = &task;
+            batchSize      = taskCount;
+            nextTask       = 0;
+            pendingTasks   = taskCount;
+            batchException = nullptr;
+            batchId++;
+        }
+        wakeWorkers.notify_all();
+
+        runBatchTasks();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        batchDone.wait(lock, [this]{ return pendingTasks == 0; });
+        batchTask = nullptr;
+
+        if (batchException)
+        {
+            std::rethrow_exception(batchException);
+        }
+    }
+
+    // Splits [0, count) into contiguous ranges and runs rangeTask(begin, end) for each of them.
+    void parallelFor(size_t count, const std::function<void(size_t, size_t)>& rangeTask)
+    {
+        const size_t rangeCount = std::min(count, size() * 4);
+        parallelTasks(rangeCount, [&](size_t range)
+        {
+            rangeTask(count * range / rangeCount, count * (range + 1) / rangeCount);
+        });
+    }
+
+private:
+    void workerLoop()
+    {
+        size_t lastBatch = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeWorkers.wait(lock, [&]{ return stopping || (batchTask && batchId != lastBatch); });
+                if (stopping)
+                {
+                    return;
+                }
+                lastBatch = batchId;
+            }
+            runBatchTasks();
+        }
+    }
+
+    void runBatchTasks()
+    {
+        while (true)
+        {
+            const std::function<void(size_t)>* task;
+            size_t taskIndex;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!batchTask || nextTask >= batchSize)
+                {
+                    return;
+                }
+                task      = batchTask;
+                taskIndex = nextTask++;
+            }
+
+            try
+            {
+                (*task)(taskIndex);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!batchException)
+                {
+                    batchException = std::current_exception();
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pendingTasks == 0)
+            {
+                batchDone.notify_all();
+            }
+        }
+    }
+
+    std::vector<std::thread>           workers;
+    std::mutex                         batchMutex;
+    std::mutex                         mutex;
+    std::condition_variable            wakeWorkers;
+    std::condition_variable            batchDone;
+    const std::function<void(size_t)>* batchTask      = nullptr;
+    size_t                             batchSize      = 0;
+    size_t                             nextTask       = 0;
+    size_t                             pendingTasks   = 0;
+    size_t                             batchId        = 0;
+    std::exception_ptr                 batchException = nullptr;
+    bool                               stopping       = false;
+};
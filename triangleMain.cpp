@@ -5,6 +5,7 @@
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/hash.hpp>
@@ -16,6 +17,20 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
 
+#include "deviceAllocator.h"
+#include "fileCache.h"
+#include "frameScheduler.h"
+#include "jobSystem.h"
+#include "meshOptimizer.h"
+#include "meshSimplifier.h"
+#include "meshlets.h"
+#include "mipGenerator.h"
+#include "renderGraph.h"
+#include "shaderCompiler.h"
+#include "stagingRing.h"
+#include "textureCompression.h"
+#include "threadPool.h"
+
 #include <chrono>
 
 #include <iostream>
@@ -30,6 +45,12 @@
 #include <set>
 #include <optional>
 #include <unordered_map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <utility>
 
 
 const int WIDTH   = 800;
@@ -38,8 +59,29 @@ const char* TITLE = "Vulkan";
 
 const std::string MODEL_PATH = "models/chalet.obj";
 const std::string TEXTURE_PATH = "textures/chalet.jpg";
+const std::string PIPELINE_CACHE_PATH = "pipeline.cache";
+
+#ifndef SHADER_SOURCE_DIR
+#define SHADER_SOURCE_DIR "shaders"
+#endif
+const std::string              SHADER_SOURCE_PATH = SHADER_SOURCE_DIR; // the GLSL sources, watched for changes
+const std::vector<std::string> SHADER_SOURCES     = {"triangle.vert", "triangle_compact.vert", "triangle.frag"};
+
+const uint64_t FRAME_TIMEOUT_NS = 100ull * 1000 * 1000; // a frame or swap chain image taking longer is skipped, and retried after polling events
+const float    RESIZE_SETTLE_MS = 50.0f; // resize events closer together than this are one burst, recreated once it settles
+
+const VkDeviceSize STAGING_RING_SIZE = 32ull * 1024 * 1024; // larger uploads get a staging buffer of their own
+
+const VkMemoryPropertyFlags TRANSIENT_ATTACHMENT_MEMORY = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+
+const size_t VERTEX_CACHE_SIZE = 16; // FIFO entries assumed by mesh optimization and its statistics
+
+const size_t MESHLET_MAX_VERTICES  = 64;
+const size_t MESHLET_MAX_TRIANGLES = 124;
 
-const int MAX_FRAMES_IN_FLIGHT = 2;
+const uint32_t INSTANCE_MATERIAL_COUNT = 8;  // tints in the vertex shaders, material 0 is white
+const float    INSTANCE_SPACING        = 2.2f; // grid spacing in mesh radii
+const std::vector<uint32_t> INSTANCE_SWEEP = {1, 10, 100, 1000, 10000, 100000};
 
 const char* DEBUG_EXTENSION = "VK_EXT_debug_report";
 
@@ -79,6 +121,228 @@ void DestroyDebugReportCallbackEXT(VkInstance& instance, VkDebugReportCallbackEX
     }
 }
 
+enum class MeshOptimization : uint32_t
+{
+    None,
+    VertexCache, // vertex cache and vertex fetch order
+    Overdraw,    // additionally sort triangle clusters front to back
+};
+
+enum class MipmapGeneration
+{
+    Auto, // the CPU while the texture cache is on, so the chain can be cached, the GPU otherwise
+    Gpu,  // vkCmdBlitImage, one level after the other, never cached
+    Cpu,  // filtered on the worker threads and uploaded with the base level
+};
+
+enum class DrawSubmission
+{
+    Indirect, // the index ranges of a frame in one indirect draw, recorded inline
+    Direct,   // one draw per range and instance, recorded into secondary command buffers on the worker threads
+};
+
+enum class TextureFormat
+{
+    Auto,  // the best block compressed format the device samples, RGBA8 without one
+    Rgba8,
+    Bc1,
+    Bc7,
+};
+
+struct Settings
+{
+    uint32_t         workerThreads    = 0; // 0 uses one thread per hardware core
+    bool             meshCache        = true;
+    bool             pipelineCache    = true; // load the pipeline cache at startup and save it on shutdown
+    bool             compactVertices  = false;
+    MeshOptimization meshOptimization = MeshOptimization::None;
+    bool             meshletCulling   = true;
+    uint32_t         lodLevels        = 5;    // including the full mesh, every level halves the triangle count
+    float            lodThreshold     = 1.0f; // largest tolerated simplification error in pixels
+    uint32_t         instanceCount    = 1;
+    bool             instanceSweep    = false; // benchmark every instance count of INSTANCE_SWEEP in turn
+    uint32_t         benchmarkFrames  = 0; // render this many frames, print frame time statistics and exit
+    MipmapGeneration mipmaps          = MipmapGeneration::Auto; // the CPU is used anyway if the format cannot be blitted linearly
+    MipFilter        mipFilter        = MipFilter::Kaiser;     // CPU generation only
+    TextureFormat    textureFormat    = TextureFormat::Auto;   // compressed formats are read from the textureEncoder output
+    bool             textureCache     = true; // keep the decoded RGBA8 mip chain next to the texture, unless mipmaps are blitted
+    bool             textureStreaming = true; // upload the texture on a background thread, coarse levels first
+    DrawSubmission   drawSubmission   = DrawSubmission::Indirect;
+    uint32_t         framesInFlight   = 2;
+    bool             lowLatency       = false; // sample input and animation once the device caught up, just before the submission
+    bool             serialInit       = false; // run the startup jobs one after the other, for comparison
+    bool             shaderReload     = true;  // rebuild the pipeline when a shader source changes
+};
+
+Settings parseArguments(int argc, char** argv)
+{
+    Settings settings;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string argument = argv[i];
+        const size_t      separator = argument.find('=');
+        const std::string name      = argument.substr(0, separator);
+        const std::string value     = separator == std::string::npos ? "" : argument.substr(separator + 1);
+
+        if (name == "--threads")
+        {
+            settings.workerThreads = static_cast<uint32_t>(std::stoul(value));
+        }
+        else if (name == "--mesh-cache")
+        {
+            settings.meshCache = value != "off";
+        }
+        else if (name == "--pipeline-cache")
+        {
+            settings.pipelineCache = value != "off";
+        }
+        else if (name == "--shader-reload")
+        {
+            settings.shaderReload = value != "off";
+        }
+        else if (name == "--vertex-layout")
+        {
+            if (value != "full" && value != "compact")
+            {
+                throw std::invalid_argument("vertex layout must be full or compact");
+            }
+            settings.compactVertices = value == "compact";
+        }
+        else if (name == "--optimize-mesh")
+        {
+            if (value == "off")
+            {
+                settings.meshOptimization = MeshOptimization::None;
+            }
+            else if (value == "cache")
+            {
+                settings.meshOptimization = MeshOptimization::VertexCache;
+            }
+            else if (value == "overdraw")
+            {
+                settings.meshOptimization = MeshOptimization::Overdraw;
+            }
+            else
+            {
+                throw std::invalid_argument("mesh optimization must be off, cache or overdraw");
+            }
+        }
+        else if (name == "--meshlet-culling")
+        {
+            settings.meshletCulling = value != "off";
+        }
+        else if (name == "--lod-levels")
+        {
+            settings.lodLevels = std::max(1u, static_cast<uint32_t>(std::stoul(value)));
+        }
+        else if (name == "--lod-threshold")
+        {
+            settings.lodThreshold = std::stof(value);
+        }
+        else if (name == "--instances")
+        {
+            settings.instanceCount = std::max(1u, static_cast<uint32_t>(std::stoul(value)));
+        }
+        else if (name == "--instance-sweep")
+        {
+            settings.instanceSweep = value != "off";
+        }
+        else if (name == "--benchmark-frames")
+        {
+            settings.benchmarkFrames = static_cast<uint32_t>(std::stoul(value));
+        }
+        else if (name == "--mipmaps")
+        {
+            if (value != "auto" && value != "gpu" && value != "cpu")
+            {
+                throw std::invalid_argument("mipmaps must be auto, gpu or cpu");
+            }
+            settings.mipmaps = value == "cpu" ? MipmapGeneration::Cpu : value == "gpu" ? MipmapGeneration::Gpu : MipmapGeneration::Auto;
+        }
+        else if (name == "--mip-filter")
+        {
+            if (value != "box" && value != "kaiser")
+            {
+                throw std::invalid_argument("mip filter must be box or kaiser");
+            }
+            settings.mipFilter = value == "box" ? MipFilter::Box : MipFilter::Kaiser;
+        }
+        else if (name == "--texture-cache")
+        {
+            settings.textureCache = value != "off";
+        }
+        else if (name == "--texture-streaming")
+        {
+            settings.textureStreaming = value != "off";
+        }
+        else if (name == "--frames-in-flight")
+        {
+            settings.framesInFlight = std::max(1u, static_cast<uint32_t>(std::stoul(value)));
+        }
+        else if (name == "--low-latency")
+        {
+            settings.lowLatency = value != "off";
+        }
+        else if (name == "--serial-init")
+        {
+            settings.serialInit = value != "off";
+        }
+        else if (name == "--draws")
+        {
+            if (value != "indirect" && value != "direct")
+            {
+                throw std::invalid_argument("draws must be indirect or direct");
+            }
+            settings.drawSubmission = value == "direct" ? DrawSubmission::Direct : DrawSubmission::Indirect;
+        }
+        else if (name == "--texture-format")
+        {
+            if (value == "auto")
+            {
+                settings.textureFormat = TextureFormat::Auto;
+            }
+            else if (value == "rgba8")
+            {
+                settings.textureFormat = TextureFormat::Rgba8;
+            }
+            else if (value == "bc1")
+            {
+                settings.textureFormat = TextureFormat::Bc1;
+            }
+            else if (value == "bc7")
+            {
+                settings.textureFormat = TextureFormat::Bc7;
+            }
+            else
+            {
+                throw std::invalid_argument("texture format must be auto, rgba8, bc1 or bc7");
+            }
+        }
+        else
+        {
+            throw std::invalid_argument("unknown argument " + argument);
+        }
+    }
+
+    if (settings.instanceSweep && settings.benchmarkFrames == 0)
+    {
+        settings.benchmarkFrames = 300;
+    }
+    return settings;
+}
+
+template<typename T>
+struct ArrayView
+{
+    const T* data  = nullptr;
+    size_t   count = 0;
+
+    size_t byteSize() const
+    {
+        return sizeof(T) * count;
+    }
+};
+
 struct QueueFamilyIndices
 {
     std::optional<uint32_t> graphicsFamily;
@@ -139,6 +403,12 @@ struct Vertex {
 
         return attributeDescriptions;
     }
+
+    // Changes whenever the memory layout changes, so cached vertex data of another layout is rejected
+    static constexpr uint32_t layoutKey()
+    {
+        return static_cast<uint32_t>(sizeof(Vertex) | offsetof(Vertex, color) << 8 | offsetof(Vertex, texCoord) << 16);
+    }
 };
 
 namespace std
@@ -154,6 +424,176 @@ namespace std
     };
 }
 
+// Per instance vertex data at binding 1, the transform takes locations 3 to 6
+struct InstanceData {
+    glm::mat4 transform;
+    uint32_t  materialIndex;
+    uint32_t  padding[3];
+
+    static VkVertexInputBindingDescription getBindingDescription()
+    {
+        VkVertexInputBindingDescription bindingDescription = {};
+        bindingDescription.binding   = 1;
+        bindingDescription.stride    = sizeof(InstanceData);
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+        return bindingDescription;
+    }
+
+    static std::array<VkVertexInputAttributeDescription, 5> getAttributeDescriptions()
+    {
+        std::array<VkVertexInputAttributeDescription, 5> attributeDescriptions = {};
+
+        for (uint32_t column = 0; column < 4; column++)
+        {
+            attributeDescriptions[column].binding  = 1;
+            attributeDescriptions[column].location = 3 + column;
+            attributeDescriptions[column].format   = VK_FORMAT_R32G32B32A32_SFLOAT;
+            attributeDescriptions[column].offset   = offsetof(InstanceData, transform) + column * sizeof(glm::vec4);
+        }
+
+        attributeDescriptions[4].binding  = 1;
+        attributeDescriptions[4].location = 7;
+        attributeDescriptions[4].format   = VK_FORMAT_R32_UINT;
+        attributeDescriptions[4].offset   = offsetof(InstanceData, materialIndex);
+
+        return attributeDescriptions;
+    }
+};
+
+// Attribute layout of the uploaded vertex buffer. The full layout is struct Vertex as is, the compact
+// layout stores positions as unorm16 relative to the mesh bounds, texture coordinates as unorm16 or
+// half floats and drops the color if it is the same for every vertex.
+struct VertexLayout
+{
+    bool                                           compact        = false;
+    uint32_t                                       stride         = sizeof(Vertex);
+    std::vector<VkVertexInputAttributeDescription> attributes;
+    bool                                           hasColor       = true;
+    glm::vec3                                      constantColor  = glm::vec3(1.0f);
+    glm::mat4                                      dequantization = glm::mat4(1.0f); // maps unorm16 positions back to model space
+    glm::vec3                                      positionMin    = glm::vec3(0.0f);
+    glm::vec3                                      positionExtent = glm::vec3(1.0f);
+    bool                                           unormTexCoords = true;
+};
+
+struct MeshCacheHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t vertexLayout;
+    uint32_t meshOptimization;
+    uint32_t lodLevels;
+    uint64_t sourceHash;
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint64_t lodOffset;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t lodCount;
+    uint32_t reserved;
+};
+
+// Followed by the data of vkGetPipelineCacheData, whose own header names vendor, device and cache UUID
+struct PipelineCacheHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t driverVersion;
+    float    coldCompileMs; // of the graphics pipeline without a cache, to compare cache hits against
+    uint32_t dataSize;
+};
+
+const char     PIPELINE_CACHE_MAGIC[8] = "VTPIPE";
+const uint32_t PIPELINE_CACHE_VERSION  = 1;
+
+// Index range of one level of detail, all levels share the vertex buffer
+struct MeshLod
+{
+    uint32_t firstIndex   = 0;
+    uint32_t indexCount   = 0;
+    float    error        = 0.0f; // simplification error in model units
+    uint32_t firstMeshlet = 0;
+    uint32_t meshletCount = 0;
+};
+
+const char     MESH_CACHE_MAGIC[8] = "VTMESH";
+const uint32_t MESH_CACHE_VERSION  = 3;
+
+struct DrawStatistics
+{
+    uint32_t lod            = 0;
+    uint32_t instances      = 1;
+    uint64_t triangles      = 0; // over all instances
+    uint32_t visible        = 0; // meshlets
+    uint32_t frustumCulled  = 0;
+    uint32_t backfaceCulled = 0;
+    uint32_t drawCommands   = 0; // visible meshlets merged into contiguous index ranges
+    uint32_t recordedDraws  = 0; // draw calls in the command buffers, one per range and instance for direct draws
+    float    recordMs       = 0.0f;
+};
+
+struct BenchmarkResult
+{
+    uint32_t instances = 1;
+    float    averageMs = 0.0f;
+    float    medianMs  = 0.0f;
+    float    p99Ms     = 0.0f;
+    double   triangles = 0.0; // per frame
+    float    recordMs  = 0.0f;
+};
+
+// One mip level in host memory
+struct TextureLevelData
+{
+    const uint8_t* data   = nullptr;
+    size_t         size   = 0;
+    uint32_t       width  = 0;
+    uint32_t       height = 0;
+};
+
+// A whole mip chain, backed by a mapped texture file or by a chain decoded from the source image
+struct TextureLevels
+{
+    MappedFile                    file;
+    std::vector<uint8_t>          chain;
+    std::vector<TextureLevelData> levels;
+};
+
+// The RGBA8 base level of the source image
+struct DecodedImage
+{
+    std::unique_ptr<stbi_uc, decltype(&stbi_image_free)> pixels{nullptr, stbi_image_free};
+    int                                                  width  = 0;
+    int                                                  height = 0;
+};
+
+// The texture as far as it can be read before the device exists: the cached chain when there is one, otherwise
+// the decoded source unless a compressed file or the texture streamer may make that unnecessary
+struct TextureSource
+{
+    MappedFile                     file;
+    uint64_t                       hash = 0;
+    std::string                    cachePath;
+    std::unique_ptr<TextureLevels> cached;
+    DecodedImage                   decoded;
+};
+
+// Levels the texture streamer uploaded and released to the graphics queue family
+struct StreamedTextureLevels
+{
+    uint32_t    firstLevel = 0;
+    uint32_t    levelCount = 0;
+    VkSemaphore uploaded   = VK_NULL_HANDLE; // signalled by the transfer submission
+};
+
+// Command pools of one frame in flight, one per recording thread, reset together once the frame's fence signalled
+struct FrameCommandPools
+{
+    std::vector<VkCommandPool>   pools;
+    std::vector<VkCommandBuffer> secondaries; // one per pool
+    VkCommandBuffer              primary = VK_NULL_HANDLE; // from the first pool
+};
+
 struct UniformBufferObject {
     glm::mat4 model;
     glm::mat4 view;
@@ -164,7 +604,10 @@ struct UniformBufferObject {
 class HelloTriangleApplication
 {
 public:
-    HelloTriangleApplication()
+    HelloTriangleApplication(const Settings& settings)
+        : settings(settings)
+        , threadPool(std::make_unique<ThreadPool>(settings.workerThreads))
+        , launchTime(std::chrono::high_resolution_clock::now())
     {
         initWindow();
         initVulkan();
@@ -195,38 +638,80 @@ private:
     {
         auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
         app->framebufferResized = true;
+        app->resizeEvents++;
+        app->lastResizeEvent = std::chrono::high_resolution_clock::now();
     }
 
 
+    // Startup as a graph of jobs on a work-stealing job system, so reading the model, the texture and the shaders
+    // overlaps with creating the device and the pipeline with the uploads. Jobs touching the staging ring depend
+    // on each other, since it records from one thread at a time. All GPU work of the startup is recorded into the
+    // staging ring and submitted by the single flush at the end, unless the uploads outgrow the ring. The first
+    // frame queues behind it instead of waiting for it.
     void initVulkan()
     {
-        createInstance();
-        createSurface();
-        pickPhysicalDevice();
-        createLogicalDevice();
-        createSwapChain();
-        createImageViews();
-        createRenderPass();
-        createDescriptorSetLayout();
-        createGraphicsPipeline();
-        createCommandPool();
-        createColorResources();
-        createDepthResources();
-        createFramebuffers();
-        createTextureImage();
-        createTextureImageView();
-        createTextureSampler();
-        loadModel();
-        createVertexBuffer();
-        createIndexBuffer();
-        createUniformBuffer();
-        createDescriptorPool();
-        createDescriptorSets();
-        createCommandBuffers();
-        createSyncObjects();
+        JobGraph startup;
+        const uint32_t modelJob         = startup.add("load model", [this]{ loadModel(); prepareLods(); });
+        const uint32_t textureSourceJob = startup.add("read texture", [this]{ loadTextureSource(); });
+        const uint32_t shadersJob       = startup.add("read shaders", [this]{ loadShaderCode(); });
+        const uint32_t deviceJob        = startup.add("instance and device", [this]
+        {
+            createInstance();
+            createSurface();
+            pickPhysicalDevice();
+            createLogicalDevice();
+        });
+        const uint32_t layoutJob        = startup.add("vertex layout", [this]{ chooseVertexLayout(); }, {modelJob, deviceJob});
+        const uint32_t swapChainJob     = startup.add("swap chain", [this]{ createSwapChain(); createImageViews(); createRenderGraph(); }, {deviceJob});
+        const uint32_t setLayoutJob     = startup.add("descriptor set layout", [this]{ createDescriptorSetLayout(); }, {deviceJob});
+        const uint32_t cacheJob         = startup.add("pipeline cache", [this]{ createPipelineCache(); }, {deviceJob});
+        const uint32_t pipelineJob      = startup.add("pipeline", [this]{ createGraphicsPipeline(); }, {shadersJob, layoutJob, swapChainJob, setLayoutJob, cacheJob});
+        const uint32_t stagingJob       = startup.add("staging ring", [this]{ createCommandPool(); createStagingRing(); }, {deviceJob});
+        const uint32_t textureJob       = startup.add("texture", [this]
+        {
+            createTextureImage();
+            createTextureImageView();
+            createTextureSampler();
+        }, {textureSourceJob, stagingJob});
+        const uint32_t buffersJob       = startup.add("buffers", [this]
+        {
+            createVertexBuffer();
+            createIndexBuffer();
+            createInstanceBuffer();
+            createUniformBuffer();
+            createIndirectBuffers();
+        }, {layoutJob, textureJob});
+        const uint32_t descriptorsJob   = startup.add("descriptors", [this]{ createDescriptorPool(); createDescriptorSets(); }, {setLayoutJob, buffersJob});
+        const uint32_t framesJob        = startup.add("frames", [this]{ createFrameCommandPools(); createSyncObjects(); }, {deviceJob});
+        startup.add("upload submission", [this]{ stagingRing->flush(); }, {descriptorsJob, pipelineJob, framesJob});
+
+        // GLFW only answers on the main thread, the swap chain job runs on any
+        queryFramebufferExtent();
+
+        JobSystem jobs(settings.serialInit ? 1 : settings.workerThreads);
+        startup.run(jobs);
+
+        printMemoryStatistics();
+        printStartupTimeline(startup, jobs);
+        startShaderWatcher();
+    }
+
+    // Sequential is what the startup took before it ran as a graph, the critical path what it can take at best
+    void printStartupTimeline(const JobGraph& startup, const JobSystem& jobs)
+    {
+        std::cout << "Startup in " << startup.lengthMs() << " ms on " << jobs.size() << " thread(s), " << jobs.stolenJobs() << " job(s) stolen, GPU work in "
+                  << stagingRing->submissions() << " submission(s)" << std::endl;
+        std::cout << "\tsequential " << startup.serialMs() << " ms, critical path " << startup.criticalPathMs() << " ms" << std::endl;
+        for (const JobTiming& timing : startup.timeline())
+        {
+            std::cout << "\t" << timing.startMs << " - " << timing.endMs << " ms\tthread " << timing.thread << "\t" << timing.name
+                      << (timing.onCriticalPath ? " (critical)" : "") << std::endl;
+        }
     }
 
 
+    // The new swap chain takes over from the old one, which is retired together with everything else the frames
+    // in flight may still use, so the device keeps running during the recreation
     void recreateSwapChain()
     {
         int width = 0, height = 0;
@@ -235,54 +720,205 @@ private:
             glfwGetFramebufferSize(window, &width, &height);
             glfwWaitEvents();
         }
+        queryFramebufferExtent();
 
-        vkDeviceWaitIdle(device);
-
-        cleanupSwapChain();
+        const auto startTime = std::chrono::high_resolution_clock::now();
+        printRenderGraphStatistics();
 
+        const VkFormat                 previousFormat = swapChainImageFormat;
+        const VkSwapchainKHR           oldSwapChain   = swapChain;
+        const std::vector<VkImageView> oldImageViews  = swapChainImageViews;
         createSwapChain();
         createImageViews();
-        createRenderPass();
-        createGraphicsPipeline();
-        createColorResources();
-        createDepthResources();
-        createFramebuffers();
-        createCommandBuffers();
+        frameScheduler->retire([device = device, oldSwapChain, oldImageViews]
+        {
+            for (VkImageView imageView : oldImageViews)
+            {
+                vkDestroyImageView(device, imageView, nullptr);
+            }
+            vkDestroySwapchainKHR(device, oldSwapChain, nullptr);
+        });
+
+        const auto retire = [this](std::function<void()> destroy){ frameScheduler->retire(std::move(destroy)); };
+
+        // Render passes only depend on formats and sample counts, and the pipeline only on the render pass
+        std::lock_guard<std::mutex> lock(pipelineMutex);
+        const bool keepPipeline = swapChainImageFormat == previousFormat;
+        if (keepPipeline)
+        {
+            renderGraph->updateImport(swapChainImport, swapChainImages, swapChainImageViews);
+            renderGraph->resize(swapChainExtent, retire);
+        }
+        else
+        {
+            retire([device = device, graph = std::shared_ptr<RenderGraph>(std::move(renderGraph)), pipeline = graphicsPipeline, layout = pipelineLayout]() mutable
+            {
+                graph.reset();
+                vkDestroyPipeline(device, pipeline, nullptr);
+                vkDestroyPipelineLayout(device, layout, nullptr);
+            });
+            if (reloadedPipeline != VK_NULL_HANDLE)
+            {
+                // Made for the old render pass and never bound, the rebuild below uses the same shaders
+                vkDestroyPipeline(device, reloadedPipeline, nullptr);
+                reloadedPipeline = VK_NULL_HANDLE;
+            }
+            createRenderGraph();
+            createGraphicsPipeline();
+        }
+
+        const float stallMs = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - startTime).count();
+        std::cout << "Swap chain recreated at " << swapChainExtent.width << "x" << swapChainExtent.height << " in " << stallMs << " ms for "
+                  << resizeEvents << " resize event(s), " << frameScheduler->retiredCount() << " retirement(s) pending, "
+                  << (keepPipeline ? "render passes and pipeline kept" : "surface format changed, render passes and pipeline rebuilt") << std::endl;
+        framebufferResized = false;
+        resizeEvents       = 0;
     }
 
 
     void mainLoop()
     {
+        auto lastFrameTime = std::chrono::high_resolution_clock::now();
+
         while(!glfwWindowShouldClose(window))
         {
-            glfwPollEvents();
+            if (!settings.lowLatency)
+            {
+                glfwPollEvents();
+            }
             drawFrame();
+
+            if (settings.benchmarkFrames > 0)
+            {
+                auto frameTime = std::chrono::high_resolution_clock::now();
+                frameTimes.push_back(std::chrono::duration<float, std::chrono::milliseconds::period>(frameTime - lastFrameTime).count());
+                frameDrawStatistics.push_back(drawStatistics);
+                frameLatencies.insert(frameLatencies.end(), frameScheduler->completedLatencies().begin(), frameScheduler->completedLatencies().end());
+                lastFrameTime  = frameTime;
+
+                if (frameTimes.size() >= settings.benchmarkFrames)
+                {
+                    sweepResults.push_back(printBenchmark());
+                    frameTimes.clear();
+                    frameDrawStatistics.clear();
+                    frameLatencies.clear();
+
+                    // The indirect commands carry the instance count, so the next step needs no re-recording
+                    if (settings.instanceSweep && sweepResults.size() < INSTANCE_SWEEP.size())
+                    {
+                        activeInstanceCount = INSTANCE_SWEEP[sweepResults.size()];
+                    }
+                    else
+                    {
+                        if (settings.instanceSweep)
+                        {
+                            printInstanceSweep();
+                        }
+                        glfwSetWindowShouldClose(window, GLFW_TRUE);
+                    }
+                }
+            }
         }
 
+        stopTextureStreamer();
         vkDeviceWaitIdle(device);
     }
 
-    void cleanupSwapChain()
+    void printMemoryStatistics()
+    {
+        const DeviceAllocatorStats stats = memoryAllocator->stats();
+        std::cout << "Device memory: " << stats.blockCount << " blocks (" << stats.blockBytes / (1024 * 1024) << " MiB), "
+                  << stats.dedicatedCount << " dedicated allocations (" << stats.dedicatedBytes / (1024 * 1024) << " MiB)" << std::endl;
+        std::cout << "\t" << stats.allocationCount << " sub-allocations, " << stats.usedBytes / 1024 << " KiB in use, "
+                  << stats.freeRangeCount << " free ranges, largest " << stats.largestFreeRange / 1024 << " KiB, fragmentation "
+                  << stats.fragmentation * 100.0f << "%" << std::endl;
+    }
+
+    BenchmarkResult printBenchmark()
     {
-        vkDestroyImageView(device, colorImageView, nullptr);
-        vkDestroyImage(device, colorImage, nullptr);
-        vkFreeMemory(device, colorImageMemory, nullptr);
+        std::vector<float> sorted = frameTimes;
+        std::sort(sorted.begin(), sorted.end());
+        float total = 0.0f;
+        for (float frameMs : sorted)
+        {
+            total += frameMs;
+        }
 
-        vkDestroyImageView(device, depthImageView, nullptr);
-        vkDestroyImage(device, depthImage, nullptr);
-        vkFreeMemory(device, depthImageMemory, nullptr);
+        std::cout << "Benchmark (" << (vertexLayout.compact ? "compact" : "full") << " vertex layout, " << activeInstanceCount << " instances)" << std::endl;
+        std::cout << "\tvertex buffer " << vertexBufferSize / 1024 << " KiB (" << vertexLayout.stride << " bytes/vertex), "
+                  << "index buffer " << meshIndices.byteSize() / 1024 << " KiB" << std::endl;
+        std::cout << "\t" << sorted.size() << " frames: avg " << total / sorted.size() << " ms, median " << sorted[sorted.size() / 2]
+                  << " ms, p99 " << sorted[sorted.size() * 99 / 100] << " ms, min " << sorted.front() << " ms, max " << sorted.back() << " ms" << std::endl;
 
-        for (auto framebuffer : swapChainFramebuffers)
+        double triangles = 0.0, visible = 0.0, frustumCulled = 0.0, backfaceCulled = 0.0, drawCommands = 0.0, recordedDraws = 0.0, recordMs = 0.0;
+        std::vector<uint32_t> lodFrames(lods.size(), 0);
+        for (const DrawStatistics& statistics : frameDrawStatistics)
         {
-            vkDestroyFramebuffer(device, framebuffer, nullptr);
+            triangles      += statistics.triangles;
+            visible        += statistics.visible;
+            frustumCulled  += statistics.frustumCulled;
+            backfaceCulled += statistics.backfaceCulled;
+            drawCommands   += statistics.drawCommands;
+            recordedDraws  += statistics.recordedDraws;
+            recordMs       += statistics.recordMs;
+            lodFrames[statistics.lod]++;
         }
+        const double frames = double(frameDrawStatistics.size());
 
-        vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+        std::cout << "\t" << triangles / frames << " triangles per frame, frames per LOD:";
+        for (uint32_t count : lodFrames)
+        {
+            std::cout << " " << count;
+        }
+        std::cout << std::endl;
 
-        vkDestroyPipeline(device, graphicsPipeline, nullptr);
-        vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-        vkDestroyRenderPass(device, renderPass, nullptr);
+        if (settings.meshletCulling)
+        {
+            std::cout << "\t" << meshlets.size() << " meshlets, per frame: " << visible / frames << " visible, " << frustumCulled / frames << " frustum culled, "
+                      << backfaceCulled / frames << " backface culled, " << drawCommands / frames << " draw ranges"
+                      << (multiDrawIndirect ? "" : " (no multiDrawIndirect)") << std::endl;
+        }
+
+        if (!frameLatencies.empty())
+        {
+            std::vector<float> latencies = frameLatencies;
+            std::sort(latencies.begin(), latencies.end());
+            float totalLatency = 0.0f;
+            for (float latencyMs : latencies)
+            {
+                totalLatency += latencyMs;
+            }
+            std::cout << "\tlatency from frame start to completion: avg " << totalLatency / latencies.size() << " ms, p99 " << latencies[latencies.size() * 99 / 100]
+                      << " ms (" << frameScheduler->framesInFlight() << " frames in flight" << (settings.lowLatency ? ", low latency" : "") << ")" << std::endl;
+        }
+
+        std::cout << "\trecording " << recordMs / frames << " ms for " << recordedDraws / frames << " draws per frame ("
+                  << (settings.drawSubmission == DrawSubmission::Direct ? std::to_string(threadPool->size()) + " threads, secondary command buffers" : "indirect, inline") << ")" << std::endl;
+
+        BenchmarkResult result;
+        result.instances = activeInstanceCount;
+        result.averageMs = total / sorted.size();
+        result.medianMs  = sorted[sorted.size() / 2];
+        result.p99Ms     = sorted[sorted.size() * 99 / 100];
+        result.triangles = triangles / frames;
+        result.recordMs  = float(recordMs / frames);
+        return result;
+    }
+
+    void printInstanceSweep()
+    {
+        std::cout << "Instance sweep (" << settings.benchmarkFrames << " frames each)" << std::endl;
+        std::cout << "\tinstances\tavg ms\tmedian ms\tp99 ms\tM triangles/frame\tM triangles/s\trecord ms" << std::endl;
+        for (const BenchmarkResult& result : sweepResults)
+        {
+            std::cout << "\t" << result.instances << "\t" << result.averageMs << "\t" << result.medianMs << "\t" << result.p99Ms << "\t"
+                      << result.triangles / 1e6 << "\t" << result.triangles / 1e3 / std::max(result.averageMs, 0.001f) << "\t" << result.recordMs << std::endl;
+        }
+    }
 
+    // The render graph and the pipeline outlive the swap chain, a resize only rebuilds what depends on its extent
+    void cleanupSwapChain()
+    {
         for (auto imageView : swapChainImageViews)
         {
             vkDestroyImageView(device, imageView, nullptr);
@@ -293,38 +929,85 @@ private:
 
     void cleanup()
     {
+        shaderWatcher.reset();
+        stopTextureStreamer();
+        for (size_t i = 0; i < frameUploadSemaphores.size(); i++)
+        {
+            releaseFrameUploads(i);
+        }
+
+        printRenderGraphStatistics();
+        renderGraph.reset();
+        vkDestroyPipeline(device, graphicsPipeline, nullptr);
+        vkDestroyPipeline(device, reloadedPipeline, nullptr);
+        vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
         cleanupSwapChain();
 
         vkDestroySampler(device, textureSampler, nullptr);
-        vkDestroyImageView(device, textureImageView, nullptr);
+        if (placeholderImage != VK_NULL_HANDLE)
+        {
+            // textureImageView is one of these
+            for (VkImageView view : textureLevelViews)
+            {
+                vkDestroyImageView(device, view, nullptr);
+            }
+            vkDestroyImageView(device, placeholderImageView, nullptr);
+            vkDestroyImage(device, placeholderImage, nullptr);
+            memoryAllocator->free(placeholderImageMemory);
+        }
+        else
+        {
+            vkDestroyImageView(device, textureImageView, nullptr);
+        }
 
         vkDestroyImage(device, textureImage, nullptr);
-        vkFreeMemory(device, textureImageMemory, nullptr);
+        memoryAllocator->free(textureImageMemory);
 
         vkDestroyDescriptorPool(device, descriptorPool, nullptr);
 
         vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 
-        for (size_t i = 0; i < swapChainImages.size(); i++)
+        vkDestroyBuffer(device, uniformBuffer, nullptr);
+        memoryAllocator->free(uniformBufferMemory);
+
+        for (size_t i = 0; i < indirectBuffers.size(); i++)
         {
-            vkDestroyBuffer(device, uniformBuffers[i], nullptr);
-            vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
+            vkDestroyBuffer(device, indirectBuffers[i], nullptr);
+            memoryAllocator->free(indirectBuffersMemory[i]);
         }
 
         vkDestroyBuffer(device, indexBuffer, nullptr);
-        vkFreeMemory(device, indexBufferMemory, nullptr);
+        memoryAllocator->free(indexBufferMemory);
+
+        vkDestroyBuffer(device, instanceBuffer, nullptr);
+        memoryAllocator->free(instanceBufferMemory);
 
         vkDestroyBuffer(device, vertexBuffer, nullptr);
-        vkFreeMemory(device, vertexBufferMemory, nullptr);
+        memoryAllocator->free(vertexBufferMemory);
 
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        for (size_t i = 0; i < settings.framesInFlight; i++) {
             vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
             vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
-            vkDestroyFence(device, inFlightFences[i], nullptr);
         }
+        frameScheduler.reset();
 
+        for (const FrameCommandPools& frame : frameCommandPools)
+        {
+            for (VkCommandPool pool : frame.pools)
+            {
+                vkDestroyCommandPool(device, pool, nullptr);
+            }
+        }
         vkDestroyCommandPool(device, commandPool, nullptr);
 
+        if (settings.pipelineCache && !savePipelineCache())
+        {
+            std::cerr << "failed to write pipeline cache " << PIPELINE_CACHE_PATH << std::endl;
+        }
+        vkDestroyPipelineCache(device, pipelineCache, nullptr);
+
+        stagingRing.reset();
+        memoryAllocator.reset();
 
         vkDestroyDevice(device, nullptr);
 
@@ -352,6 +1035,13 @@ private:
         std::vector<const char*> requiredExtensions = getRequiredExtensions();
         requiredExtensions.insert(requiredExtensions.end(), requestedExtensions.begin(), requestedExtensions.end());
 
+        // Optional, VK_KHR_timeline_semaphore depends on it
+        physicalDeviceProperties2 = isExtensionAvailable(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+        if (physicalDeviceProperties2)
+        {
+            requiredExtensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+        }
+
         std::cout << "EXTENSIONS" << std::endl;
         auto e = enumerateExtensions();
         for(auto l: e)
@@ -610,7 +1300,31 @@ private:
         return indices;
     }
 
-    bool isDeviceSuitable(VkPhysicalDevice device)
+    // A family with transfer but without graphics support is usually a dedicated copy engine that runs
+    // next to rendering. Families without compute are preferred, falls back to the graphics family.
+    uint32_t findTransferQueueFamily(VkPhysicalDevice device, uint32_t graphicsFamily)
+    {
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+
+        for (VkQueueFlags excludedFlags : {VkQueueFlags(VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT), VkQueueFlags(VK_QUEUE_GRAPHICS_BIT)})
+        {
+            for (uint32_t i = 0; i < queueFamilyCount; i++)
+            {
+                const VkQueueFlags flags = queueFamilies[i].queueFlags;
+                if (queueFamilies[i].queueCount > 0 && (flags & VK_QUEUE_TRANSFER_BIT) && !(flags & excludedFlags))
+                {
+                    return i;
+                }
+            }
+        }
+        return graphicsFamily;
+    }
+
+    bool isDeviceSuitable(VkPhysicalDevice device)
     {
         VkPhysicalDeviceProperties deviceProperties;
         VkPhysicalDeviceFeatures deviceFeatures;
@@ -646,10 +1360,11 @@ private:
     void createLogicalDevice()
     {
         QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
-
+        graphicsQueueFamily        = indices.graphicsFamily.value();
+        transferQueueFamily        = findTransferQueueFamily(physicalDevice, graphicsQueueFamily);
 
         std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-        std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+        std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value(), transferQueueFamily};
 
         float queuePriority = 1.0f;
         for (uint32_t queueFamily : uniqueQueueFamilies)
@@ -662,16 +1377,36 @@ private:
             queueCreateInfos.push_back(queueCreateInfo);
         }
 
+        VkPhysicalDeviceFeatures supportedFeatures;
+        vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+        multiDrawIndirect    = supportedFeatures.multiDrawIndirect == VK_TRUE;
+        textureCompressionBC = supportedFeatures.textureCompressionBC == VK_TRUE;
+
         VkPhysicalDeviceFeatures deviceFeatures     = {};
         deviceFeatures.samplerAnisotropy            = VK_TRUE;
+        deviceFeatures.multiDrawIndirect            = multiDrawIndirect ? VK_TRUE : VK_FALSE;
+        deviceFeatures.textureCompressionBC         = textureCompressionBC ? VK_TRUE : VK_FALSE;
+
+        // Frames are paced with a timeline semaphore where available, the feature comes with the extension
+        std::vector<const char*> enabledExtensions  = deviceExtensions;
+        timelineSemaphores                          = physicalDeviceProperties2 && isDeviceExtensionAvailable(physicalDevice, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+
+        VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures = {};
+        timelineFeatures.sType                      = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+        timelineFeatures.timelineSemaphore          = VK_TRUE;
 
         VkDeviceCreateInfo createInfo               = {};
         createInfo.sType                            = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
         createInfo.pQueueCreateInfos                = queueCreateInfos.data();
         createInfo.queueCreateInfoCount             = static_cast<uint32_t>(queueCreateInfos.size());
         createInfo.pEnabledFeatures                 = &deviceFeatures;
-        createInfo.enabledExtensionCount            = static_cast<uint32_t>(deviceExtensions.size());
-        createInfo.ppEnabledExtensionNames          = deviceExtensions.data();
+        if (timelineSemaphores)
+        {
+            enabledExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+            createInfo.pNext                        = &timelineFeatures;
+        }
+        createInfo.enabledExtensionCount            = static_cast<uint32_t>(enabledExtensions.size());
+        createInfo.ppEnabledExtensionNames          = enabledExtensions.data();
         createInfo.enabledLayerCount                = static_cast<uint32_t>(validationLayers.size());
         createInfo.ppEnabledLayerNames              = validationLayers.data();
 
@@ -682,6 +1417,9 @@ private:
 
         vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
         vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+        vkGetDeviceQueue(device, transferQueueFamily, 0, &transferQueue);
+
+        memoryAllocator = std::make_unique<DeviceAllocator>(physicalDevice, device);
     }
 
     void createSurface()
@@ -748,6 +1486,14 @@ private:
         return presentMode;
     }
 
+    // Main thread only, chooseSwapExtent() uses what it found
+    void queryFramebufferExtent()
+    {
+        int width, height;
+        glfwGetFramebufferSize(window, &width, &height);
+        framebufferExtent = { static_cast<uint32_t>(width), static_cast<uint32_t>(height) };
+    }
+
     VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities)
     {
         if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max())
@@ -756,10 +1502,7 @@ private:
         }
         else
         {
-            int width, height;
-            glfwGetFramebufferSize(window, &width, &height);
-
-            VkExtent2D actualExtent = { static_cast<uint32_t>(width), static_cast<uint32_t>(height) };
+            VkExtent2D actualExtent = framebufferExtent;
 
             actualExtent.width  = std::max(capabilities.minImageExtent.width,  std::min(capabilities.maxImageExtent.width,  actualExtent.width));
             actualExtent.height = std::max(capabilities.minImageExtent.height, std::min(capabilities.maxImageExtent.height, actualExtent.height));
@@ -813,12 +1556,14 @@ private:
         createInfo.compositeAlpha            = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
         createInfo.presentMode               = presentMode;
         createInfo.clipped                   = VK_TRUE;
-        createInfo.oldSwapchain              = VK_NULL_HANDLE;
+        createInfo.oldSwapchain              = swapChain; // lets the presentation engine hand its images over
 
-        if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain) != VK_SUCCESS)
+        VkSwapchainKHR newSwapChain;
+        if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &newSwapChain) != VK_SUCCESS)
         {
             throw std::runtime_error("failed to create swap chain!");
         }
+        swapChain = newSwapChain;
 
         vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
         swapChainImages.resize(imageCount);
@@ -826,7 +1571,7 @@ private:
 
     }
 
-    VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels)
+    VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels, uint32_t baseMipLevel = 0)
     {
         VkImageViewCreateInfo viewInfo           = {};
         viewInfo.sType                           = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -834,7 +1579,7 @@ private:
         viewInfo.viewType                        = VK_IMAGE_VIEW_TYPE_2D;
         viewInfo.format                          = format;
         viewInfo.subresourceRange.aspectMask     = aspectFlags;
-        viewInfo.subresourceRange.baseMipLevel   = 0;
+        viewInfo.subresourceRange.baseMipLevel   = baseMipLevel;
         viewInfo.subresourceRange.levelCount     = mipLevels;
         viewInfo.subresourceRange.baseArrayLayer = 0;
         viewInfo.subresourceRange.layerCount     = 1;
@@ -862,7 +1607,7 @@ private:
     {
         VkDescriptorSetLayoutBinding uboLayoutBinding        = {};
         uboLayoutBinding.binding                             = 0;
-        uboLayoutBinding.descriptorType                      = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        uboLayoutBinding.descriptorType                      = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
         uboLayoutBinding.descriptorCount                     = 1;
         uboLayoutBinding.stageFlags                          = VK_SHADER_STAGE_VERTEX_BIT;
         uboLayoutBinding.pImmutableSamplers                  = nullptr; // Optional
@@ -886,10 +1631,258 @@ private:
         }
     }
 
+    // The data is only used when its header matches vendor, device and cache UUID of the device and the driver
+    // version matches too, drivers are not required to reject caches of other versions
+    void createPipelineCache()
+    {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+        MappedFile                      cache;
+        PipelineCacheHeader             header     = {};
+        VkPipelineCacheHeaderVersionOne dataHeader = {};
+        bool                            isValid    = settings.pipelineCache && cache.open(PIPELINE_CACHE_PATH);
+        if (isValid)
+        {
+            isValid = cache.size() >= sizeof(header) + sizeof(dataHeader);
+            if (isValid)
+            {
+                memcpy(&header, cache.data(), sizeof(header));
+                memcpy(&dataHeader, cache.data() + sizeof(header), sizeof(dataHeader));
+            }
+            isValid &= memcmp(header.magic, PIPELINE_CACHE_MAGIC, sizeof(header.magic)) == 0;
+            isValid &= header.version == PIPELINE_CACHE_VERSION;
+            isValid &= header.driverVersion == properties.driverVersion;
+            isValid &= sizeof(header) + uint64_t(header.dataSize) <= cache.size();
+            isValid &= dataHeader.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE;
+            isValid &= dataHeader.vendorID == properties.vendorID && dataHeader.deviceID == properties.deviceID;
+            isValid &= memcmp(dataHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+            if (!isValid)
+            {
+                std::cout << "Ignoring pipeline cache " << PIPELINE_CACHE_PATH << " of another device or driver" << std::endl;
+            }
+        }
+
+        VkPipelineCacheCreateInfo cacheInfo = {};
+        cacheInfo.sType                     = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        cacheInfo.initialDataSize           = isValid ? header.dataSize : 0;
+        cacheInfo.pInitialData              = isValid ? cache.data() + sizeof(header) : nullptr;
+
+        if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create pipeline cache!");
+        }
+
+        if (isValid)
+        {
+            pipelineCacheWarm     = true;
+            pipelineColdCompileMs = header.coldCompileMs;
+            std::cout << "Loaded " << header.dataSize / 1024 << " KiB pipeline cache " << PIPELINE_CACHE_PATH << std::endl;
+        }
+    }
+
+    bool savePipelineCache()
+    {
+        size_t dataSize = 0;
+        if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr) != VK_SUCCESS)
+        {
+            return false;
+        }
+        std::vector<char> data(dataSize);
+        if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, data.data()) != VK_SUCCESS)
+        {
+            return false;
+        }
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+        PipelineCacheHeader header = {};
+        memcpy(header.magic, PIPELINE_CACHE_MAGIC, sizeof(header.magic));
+        header.version       = PIPELINE_CACHE_VERSION;
+        header.driverVersion = properties.driverVersion;
+        header.coldCompileMs = pipelineColdCompileMs;
+        header.dataSize      = static_cast<uint32_t>(dataSize);
+
+        return writeFileAtomically(PIPELINE_CACHE_PATH, [&](std::ofstream& file)
+        {
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(data.data(), dataSize);
+        });
+    }
+
+    // Both vertex shader variants are loaded, the vertex layout picks one once the device is known
+    void loadShaderCode()
+    {
+        for (const std::string& name : SHADER_SOURCES)
+        {
+            shaderCode[name] = loadShader(name);
+        }
+    }
+
+    // Compiles the GLSL source, or finds its SPIR-V in the shader cache. Without shaderc, or when the source does
+    // not compile, the default is the SPIR-V the build put into shaders/.
+    std::vector<char> loadShader(const std::string& name)
+    {
+        if (ShaderCompiler::available())
+        {
+            try
+            {
+                CompiledShader shader = shaderCompiler.compile(SHADER_SOURCE_PATH + "/" + name, shaderCachePath(name));
+                std::cout << (shader.cached ? "Loaded shader " : "Compiled shader ") << name << " in " << shader.compileMs << " ms" << std::endl;
+                return std::move(shader.code);
+            }
+            catch (const std::runtime_error& e)
+            {
+                std::cerr << e.what() << std::endl;
+                std::cerr << "falling back to the default shader " << defaultShaderPath(name) << std::endl;
+            }
+        }
+        return readFile(defaultShaderPath(name));
+    }
+
+    // triangle.vert becomes shaders/triangle_vert.spv
+    static std::string defaultShaderPath(const std::string& name)
+    {
+        const size_t extension = name.rfind('.');
+        return "shaders/" + name.substr(0, extension) + "_" + name.substr(extension + 1) + ".spv";
+    }
+
+    static std::string shaderCachePath(const std::string& name)
+    {
+        return "shaders/" + name + ".spvcache";
+    }
+
+    std::string vertexShaderName() const
+    {
+        return vertexLayout.hasColor ? "triangle.vert" : "triangle_compact.vert";
+    }
+
+    // Changed sources compile and their pipeline is built on the watcher thread, drawFrame swaps it in once it is ready
+    void startShaderWatcher()
+    {
+        if (!settings.shaderReload)
+        {
+            return;
+        }
+        if (!ShaderCompiler::available())
+        {
+            std::cout << "Shader reload needs a build with shaderc" << std::endl;
+            return;
+        }
+
+        shaderWatcher = std::make_unique<ShaderWatcher>(SHADER_SOURCE_PATH, [this](const std::string& path)
+        {
+            try
+            {
+                reloadShader(path);
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << "shader reload failed: " << e.what() << std::endl;
+            }
+        });
+        if (shaderWatcher->isWatching())
+        {
+            std::cout << "Watching " << SHADER_SOURCE_PATH << " for shader changes" << std::endl;
+        }
+        else
+        {
+            std::cerr << "failed to watch " << SHADER_SOURCE_PATH << " for shader changes" << std::endl;
+        }
+    }
+
+    // Runs on the watcher thread. A source that does not compile leaves the running pipeline in place.
+    void reloadShader(const std::string& path)
+    {
+        const std::string name = path.substr(path.rfind('/') + 1);
+        if (std::find(SHADER_SOURCES.begin(), SHADER_SOURCES.end(), name) == SHADER_SOURCES.end())
+        {
+            return;
+        }
+
+        CompiledShader shader;
+        try
+        {
+            shader = shaderCompiler.compile(path, shaderCachePath(name));
+        }
+        catch (const std::runtime_error& e)
+        {
+            std::cerr << e.what() << std::endl;
+            std::cerr << "keeping the running pipeline" << std::endl;
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(pipelineMutex);
+        shaderCode[name] = std::move(shader.code);
+        if (name != vertexShaderName() && name != "triangle.frag")
+        {
+            std::cout << "Compiled shader " << name << " in " << shader.compileMs << " ms, the pipeline does not use it" << std::endl;
+            return;
+        }
+
+        const auto      startTime = std::chrono::high_resolution_clock::now();
+        const VkPipeline pipeline = createPipeline(shaderCode.at(vertexShaderName()), shaderCode.at("triangle.frag"));
+        const float     createMs  = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+        // A reload drawFrame has not picked up yet was never bound
+        vkDestroyPipeline(device, reloadedPipeline, nullptr);
+        reloadedPipeline = pipeline;
+        std::cout << "Reloaded shader " << name << ", compiled in " << shader.compileMs << " ms, pipeline built in " << createMs << " ms" << std::endl;
+    }
+
+    // The pipeline it replaces is retired, frames in flight may still use it
+    void adoptReloadedPipeline()
+    {
+        std::lock_guard<std::mutex> lock(pipelineMutex);
+        if (reloadedPipeline == VK_NULL_HANDLE)
+        {
+            return;
+        }
+        frameScheduler->retire([device = device, pipeline = graphicsPipeline]{ vkDestroyPipeline(device, pipeline, nullptr); });
+        graphicsPipeline = reloadedPipeline;
+        reloadedPipeline = VK_NULL_HANDLE;
+    }
+
     void createGraphicsPipeline()
     {
-        auto vertShaderCode = readFile("shaders/triangle_vert.spv");
-        auto fragShaderCode = readFile("shaders/triangle_frag.spv");
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+        pipelineLayoutInfo.sType                      = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount             = 1;
+        pipelineLayoutInfo.pSetLayouts                = &descriptorSetLayout;
+        pipelineLayoutInfo.pushConstantRangeCount     = 0; // Optional
+        pipelineLayoutInfo.pPushConstantRanges        = nullptr; // Optional
+
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create pipeline layout!");
+        }
+
+        const auto startTime = std::chrono::high_resolution_clock::now();
+        graphicsPipeline     = createPipeline(shaderCode.at(vertexShaderName()), shaderCode.at("triangle.frag"));
+        const float createMs = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+        // Only the very first pipeline without cache data compiles cold, later ones find it in the cache
+        if (!pipelineCacheWarm)
+        {
+            pipelineColdCompileMs = createMs;
+            std::cout << "Graphics pipeline compiled cold in " << createMs << " ms" << std::endl;
+        }
+        else
+        {
+            std::cout << "Graphics pipeline created from the pipeline cache in " << createMs << " ms";
+            if (pipelineColdCompileMs > 0.0f)
+            {
+                std::cout << ", " << pipelineColdCompileMs << " ms cold, " << pipelineColdCompileMs / std::max(createMs, 0.001f) << "x faster";
+            }
+            std::cout << std::endl;
+        }
+        pipelineCacheWarm = true;
+    }
+
+    // The pipeline of the scene pass around the given SPIR-V, with the current pipeline layout and render pass
+    VkPipeline createPipeline(const std::vector<char>& vertShaderCode, const std::vector<char>& fragShaderCode)
+    {
         VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
         VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
 
@@ -899,6 +1892,25 @@ private:
         vertShaderStageInfo.module                               = vertShaderModule;
         vertShaderStageInfo.pName                                = "main";
 
+        std::array<VkSpecializationMapEntry, 3> colorEntries     = {};
+        for (uint32_t i = 0; i < colorEntries.size(); i++)
+        {
+            colorEntries[i].constantID                           = i;
+            colorEntries[i].offset                               = i * sizeof(float);
+            colorEntries[i].size                                 = sizeof(float);
+        }
+
+        VkSpecializationInfo colorSpecialization                 = {};
+        colorSpecialization.mapEntryCount                        = static_cast<uint32_t>(colorEntries.size());
+        colorSpecialization.pMapEntries                          = colorEntries.data();
+        colorSpecialization.dataSize                             = sizeof(vertexLayout.constantColor);
+        colorSpecialization.pData                                = &vertexLayout.constantColor;
+
+        if (!vertexLayout.hasColor)
+        {
+            vertShaderStageInfo.pSpecializationInfo              = &colorSpecialization;
+        }
+
         VkPipelineShaderStageCreateInfo fragShaderStageInfo      = {};
         fragShaderStageInfo.sType                                = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
         fragShaderStageInfo.stage                                = VK_SHADER_STAGE_FRAGMENT_BIT;
@@ -907,13 +1919,19 @@ private:
 
         VkPipelineShaderStageCreateInfo shaderStages[]           = {vertShaderStageInfo, fragShaderStageInfo};
 
-        auto bindingDescription                                  = Vertex::getBindingDescription();
-        auto attributeDescriptions                               = Vertex::getAttributeDescriptions();
+        std::array<VkVertexInputBindingDescription, 2> bindingDescriptions = {Vertex::getBindingDescription(), InstanceData::getBindingDescription()};
+        bindingDescriptions[0].stride                            = vertexLayout.stride;
+
+        auto attributeDescriptions                               = vertexLayout.attributes;
+        for (const auto& instanceAttribute : InstanceData::getAttributeDescriptions())
+        {
+            attributeDescriptions.push_back(instanceAttribute);
+        }
 
         VkPipelineVertexInputStateCreateInfo vertexInputInfo     = {};
         vertexInputInfo.sType                                    = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-        vertexInputInfo.vertexBindingDescriptionCount            = 1;
-        vertexInputInfo.pVertexBindingDescriptions               = &bindingDescription;
+        vertexInputInfo.vertexBindingDescriptionCount            = static_cast<uint32_t>(bindingDescriptions.size());
+        vertexInputInfo.pVertexBindingDescriptions               = bindingDescriptions.data();
         vertexInputInfo.vertexAttributeDescriptionCount          = static_cast<uint32_t>(attributeDescriptions.size());
         vertexInputInfo.pVertexAttributeDescriptions             = attributeDescriptions.data();
 
@@ -922,24 +1940,17 @@ private:
         inputAssembly.topology                                   = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
         inputAssembly.primitiveRestartEnable                     = VK_FALSE;
 
-        VkViewport viewport                                      = {};
-        viewport.x                                               = 0.0f;
-        viewport.y                                               = 0.0f;
-        viewport.width                                           = (float) swapChainExtent.width;
-        viewport.height                                          = (float) swapChainExtent.height;
-        viewport.minDepth                                        = 0.0f;
-        viewport.maxDepth                                        = 1.0f;
-
-        VkRect2D scissor                                         = {};
-        scissor.offset                                           = {0, 0};
-        scissor.extent                                           = swapChainExtent;
-
+        // Viewport and scissor follow the swap chain extent, they are set while recording so resizes keep the pipeline
         VkPipelineViewportStateCreateInfo viewportState          = {};
         viewportState.sType                                      = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
         viewportState.viewportCount                              = 1;
-        viewportState.pViewports                                 = &viewport;
         viewportState.scissorCount                               = 1;
-        viewportState.pScissors                                  = &scissor;
+
+        const std::array<VkDynamicState, 2> dynamicStates        = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+        VkPipelineDynamicStateCreateInfo dynamicState            = {};
+        dynamicState.sType                                       = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicState.dynamicStateCount                           = static_cast<uint32_t>(dynamicStates.size());
+        dynamicState.pDynamicStates                              = dynamicStates.data();
 
         VkPipelineRasterizationStateCreateInfo rasterizer        = {};
         rasterizer.sType                                         = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -996,18 +2007,6 @@ private:
         colorBlending.blendConstants[2]                          = 0.0f; // Optional
         colorBlending.blendConstants[3]                          = 0.0f; // Optional
 
-        VkPipelineLayoutCreateInfo pipelineLayoutInfo            = {};
-        pipelineLayoutInfo.sType                                 = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        pipelineLayoutInfo.setLayoutCount                        = 1;
-        pipelineLayoutInfo.pSetLayouts                           = &descriptorSetLayout;
-        pipelineLayoutInfo.pushConstantRangeCount                = 0; // Optional
-        pipelineLayoutInfo.pPushConstantRanges                   = nullptr; // Optional
-
-        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
-        {
-            throw std::runtime_error("failed to create pipeline layout!");
-        }
-
         VkGraphicsPipelineCreateInfo pipelineInfo                = {};
         pipelineInfo.sType                                       = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
         pipelineInfo.stageCount                                  = 2;
@@ -1019,21 +2018,24 @@ private:
         pipelineInfo.pMultisampleState                           = &multisampling;
         pipelineInfo.pDepthStencilState                          = &depthStencil;
         pipelineInfo.pColorBlendState                            = &colorBlending;
-        pipelineInfo.pDynamicState                               = nullptr; // Optional
+        pipelineInfo.pDynamicState                               = &dynamicState;
         pipelineInfo.layout                                      = pipelineLayout;
-        pipelineInfo.renderPass                                  = renderPass;
+        pipelineInfo.renderPass                                  = renderGraph->renderPass(scenePass);
         pipelineInfo.subpass                                     = 0;
         pipelineInfo.basePipelineHandle                          = VK_NULL_HANDLE; // Optional
         pipelineInfo.basePipelineIndex                           = -1; // Optional
 
-        if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS)
-        {
-            throw std::runtime_error("failed to create graphics pipeline!");
-        }
-
+        VkPipeline pipeline;
+        const VkResult result = vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline);
 
         vkDestroyShaderModule(device, fragShaderModule, nullptr);
         vkDestroyShaderModule(device, vertShaderModule, nullptr);
+
+        if (result != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create graphics pipeline!");
+        }
+        return pipeline;
     }
 
 
@@ -1070,106 +2072,24 @@ private:
         return shaderModule;
     }
 
-    void createRenderPass()
-    {
-        VkAttachmentDescription colorAttachment            = {};
-        colorAttachment.format                             = swapChainImageFormat;
-        colorAttachment.samples                            = msaaSamples;
-        colorAttachment.loadOp                             = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        colorAttachment.storeOp                            = VK_ATTACHMENT_STORE_OP_STORE;
-        colorAttachment.stencilLoadOp                      = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-        colorAttachment.stencilStoreOp                     = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        colorAttachment.initialLayout                      = VK_IMAGE_LAYOUT_UNDEFINED;
-        colorAttachment.finalLayout                        = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-        VkAttachmentReference colorAttachmentRef           = {};
-        colorAttachmentRef.attachment                      = 0;
-        colorAttachmentRef.layout                          = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-        VkAttachmentDescription depthAttachment            = {};
-        depthAttachment.format                             = findDepthFormat();
-        depthAttachment.samples                            = msaaSamples;
-        depthAttachment.loadOp                             = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        depthAttachment.storeOp                            = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        depthAttachment.stencilLoadOp                      = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-        depthAttachment.stencilStoreOp                     = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        depthAttachment.initialLayout                      = VK_IMAGE_LAYOUT_UNDEFINED;
-        depthAttachment.finalLayout                        = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-        VkAttachmentReference depthAttachmentRef           = {};
-        depthAttachmentRef.attachment                      = 1;
-        depthAttachmentRef.layout                          = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-        VkAttachmentDescription colorAttachmentResolve     = {};
-        colorAttachmentResolve.format                      = swapChainImageFormat;
-        colorAttachmentResolve.samples                     = VK_SAMPLE_COUNT_1_BIT;
-        colorAttachmentResolve.loadOp                      = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-        colorAttachmentResolve.storeOp                     = VK_ATTACHMENT_STORE_OP_STORE;
-        colorAttachmentResolve.stencilLoadOp               = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-        colorAttachmentResolve.stencilStoreOp              = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        colorAttachmentResolve.initialLayout               = VK_IMAGE_LAYOUT_UNDEFINED;
-        colorAttachmentResolve.finalLayout                 = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-        VkAttachmentReference colorAttachmentResolveRef    = {};
-        colorAttachmentResolveRef.attachment               = 2;
-        colorAttachmentResolveRef.layout                   = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-        VkSubpassDescription subpass                       = {};
-        subpass.pipelineBindPoint                          = VK_PIPELINE_BIND_POINT_GRAPHICS;
-        subpass.colorAttachmentCount                       = 1;
-        subpass.pColorAttachments                          = &colorAttachmentRef;
-        subpass.pDepthStencilAttachment                    = &depthAttachmentRef;
-        subpass.pResolveAttachments                        = &colorAttachmentResolveRef;
-
-        VkSubpassDependency dependency                     = {};
-        dependency.srcSubpass                              = VK_SUBPASS_EXTERNAL;
-        dependency.dstSubpass                              = 0;
-        dependency.srcStageMask                            = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependency.srcAccessMask                           = 0;
-        dependency.dstStageMask                            = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependency.dstAccessMask                           = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-        std::array<VkAttachmentDescription, 3> attachments = {colorAttachment, depthAttachment, colorAttachmentResolve};
-        VkRenderPassCreateInfo renderPassInfo              = {};
-        renderPassInfo.sType                               = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-        renderPassInfo.attachmentCount                     = static_cast<uint32_t>(attachments.size());
-        renderPassInfo.pAttachments                        = attachments.data();
-        renderPassInfo.subpassCount                        = 1;
-        renderPassInfo.pSubpasses                          = &subpass;
-        renderPassInfo.dependencyCount                     = 1;
-        renderPassInfo.pDependencies                       = &dependency;
-
-        if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS)
-        {
-            throw std::runtime_error("failed to create render pass!");
-        }
-    }
-
-    void createFramebuffers()
-    {
-        swapChainFramebuffers.resize(swapChainImageViews.size());
-        for (size_t i = 0; i < swapChainImageViews.size(); i++)
-        {
-            std::array<VkImageView, 3> attachments = {
-                colorImageView,
-                depthImageView,
-                swapChainImageViews[i]
-            };
-
-            VkFramebufferCreateInfo framebufferInfo = {};
-            framebufferInfo.sType                   = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-            framebufferInfo.renderPass              = renderPass;
-            framebufferInfo.attachmentCount         = static_cast<uint32_t>(attachments.size());
-            framebufferInfo.pAttachments            = attachments.data();
-            framebufferInfo.width                   = swapChainExtent.width;
-            framebufferInfo.height                  = swapChainExtent.height;
-            framebufferInfo.layers                  = 1;
-
-            if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &swapChainFramebuffers[i]) != VK_SUCCESS)
-            {
-                throw std::runtime_error("failed to create framebuffer!");
-            }
-        }
+    // The frame as a render graph: the scene pass clears and draws into the multisampled color and depth
+    // attachments and resolves into the swap chain image. Both attachments only live within the pass, so the
+    // graph keeps them in lazily allocated memory where the device offers it.
+    void createRenderGraph()
+    {
+        renderGraph = std::make_unique<RenderGraph>(device, *memoryAllocator, TRANSIENT_ATTACHMENT_MEMORY);
+
+        const uint32_t color = renderGraph->createImage("color", swapChainImageFormat, msaaSamples);
+        const uint32_t depth = renderGraph->createImage("depth", findDepthFormat(), msaaSamples);
+        swapChainImport      = renderGraph->importImage("swap chain", swapChainImageFormat, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, swapChainImages, swapChainImageViews);
+
+        const VkSubpassContents contents = settings.drawSubmission == DrawSubmission::Direct ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE;
+        scenePass = renderGraph->addPass("scene", contents, [this](const RenderGraphContext& context) { recordScenePass(context); });
+        renderGraph->clearColor(scenePass, color, {{0.0f, 0.0f, 0.0f, 1.0f}});
+        renderGraph->clearDepth(scenePass, depth, {1.0f, 0});
+        renderGraph->resolve(scenePass, swapChainImport);
+
+        renderGraph->compile(swapChainExtent);
     }
 
     void createCommandPool()
@@ -1187,24 +2107,7 @@ private:
         }
     }
 
-    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
-    {
-        VkPhysicalDeviceMemoryProperties memProperties;
-        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-
-        for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
-        {
-            if (typeFilter & (1 << i) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
-            {
-                return i;
-            }
-        }
-
-        throw std::runtime_error("failed to find suitable memory type!");
-
-    }
-
-    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory)
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, DeviceAllocation& bufferMemory)
     {
         VkBufferCreateInfo bufferInfo = {};
         bufferInfo.sType              = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -1220,22 +2123,13 @@ private:
         VkMemoryRequirements memRequirements;
         vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
 
-        VkMemoryAllocateInfo allocInfo = {};
-        allocInfo.sType                = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize       = memRequirements.size;
-        allocInfo.memoryTypeIndex      = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-        if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS)
-        {
-            throw std::runtime_error("failed to allocate buffer memory!");
-        }
-
-        vkBindBufferMemory(device, buffer, bufferMemory, 0);
+        bufferMemory = memoryAllocator->allocate(memRequirements, properties, ResourceKind::Linear);
+        vkBindBufferMemory(device, buffer, bufferMemory.memory, bufferMemory.offset);
     }
 
     void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels)
     {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+        VkCommandBuffer commandBuffer = stagingRing->commandBuffer();
 
         VkImageMemoryBarrier barrier            = {};
         barrier.sType                           = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -1249,11 +2143,6 @@ private:
         barrier.subresourceRange.levelCount     = mipLevels;
         barrier.subresourceRange.baseArrayLayer = 0;
         barrier.subresourceRange.layerCount     = 1;
-        barrier.srcAccessMask                   = 0; // TODO
-        barrier.dstAccessMask                   = 0; // TODO
-
-        VkPipelineStageFlags sourceStage;
-        VkPipelineStageFlags destinationStage;
 
         if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
         {
@@ -1265,45 +2154,14 @@ private:
             }
         }
 
-        if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
-            newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
-        {
-            barrier.srcAccessMask = 0;
-            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-            sourceStage           = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-            destinationStage      = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        }
-        else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL &&
-                 newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-        {
-            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-            sourceStage           = VK_PIPELINE_STAGE_TRANSFER_BIT;
-            destinationStage      = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-        }
-        else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
-                 newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
-        {
-            barrier.srcAccessMask = 0;
-            barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        // The same table the render graph plans its barriers with
+        const ImageLayoutAccess source      = imageLayoutAccess(oldLayout);
+        const ImageLayoutAccess destination = imageLayoutAccess(newLayout);
+        barrier.srcAccessMask               = source.access;
+        barrier.dstAccessMask               = destination.access;
 
-            sourceStage           = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-            destinationStage      = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-        }
-        else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
-                 newLayout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL)
-        {
-            barrier.srcAccessMask = 0;
-            barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-            sourceStage           = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-            destinationStage      = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        }
-        else
-        {
-            throw std::invalid_argument("unsupported layout transition!");
-        }
+        const VkPipelineStageFlags sourceStage      = source.stages;
+        const VkPipelineStageFlags destinationStage = destination.stages;
 
         vkCmdPipelineBarrier(
             commandBuffer,
@@ -1313,16 +2171,12 @@ private:
             0, nullptr,
             1, &barrier
         );
-
-        endSingleTimeCommands(commandBuffer);
     }
 
-    void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
+    void copyBufferToImage(VkBuffer buffer, VkDeviceSize bufferOffset, VkImage image, uint32_t width, uint32_t height)
     {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
         VkBufferImageCopy region               = {};
-        region.bufferOffset                    = 0;
+        region.bufferOffset                    = bufferOffset;
         region.bufferRowLength                 = 0;
         region.bufferImageHeight               = 0;
         region.imageSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -1332,19 +2186,22 @@ private:
         region.imageOffset                     = {0, 0, 0};
         region.imageExtent                     = {width, height, 1};
 
+        copyBufferToImage(buffer, image, {region});
+    }
+
+    void copyBufferToImage(VkBuffer buffer, VkImage image, const std::vector<VkBufferImageCopy>& regions)
+    {
         vkCmdCopyBufferToImage(
-            commandBuffer,
+            stagingRing->commandBuffer(),
             buffer,
             image,
             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            1,
-            &region
+            static_cast<uint32_t>(regions.size()),
+            regions.data()
         );
-
-        endSingleTimeCommands(commandBuffer);
     }
 
-    void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory)
+    void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, DeviceAllocation& imageMemory)
      {
         VkImageCreateInfo imageInfo = {};
         imageInfo.sType             = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -1369,16 +2226,14 @@ private:
         VkMemoryRequirements memRequirements;
         vkGetImageMemoryRequirements(device, image, &memRequirements);
 
-        VkMemoryAllocateInfo allocInfo = {};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memRequirements.size;
-        allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-        if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate image memory!");
+        // Lazily allocated memory is a preference, without it transient attachments get plain device memory
+        if ((properties & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) && !memoryAllocator->hasMemoryType(memRequirements.memoryTypeBits, properties))
+        {
+            properties &= ~VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
         }
 
-        vkBindImageMemory(device, image, imageMemory, 0);
+        imageMemory = memoryAllocator->allocate(memRequirements, properties, tiling == VK_IMAGE_TILING_OPTIMAL ? ResourceKind::Optimal : ResourceKind::Linear);
+        vkBindImageMemory(device, image, imageMemory.memory, imageMemory.offset);
     }
 
     VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features)
@@ -1413,24 +2268,24 @@ private:
         return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
     }
 
-    void createColorResources()
-    {
-        VkFormat colorFormat = swapChainImageFormat;
-
-        createImage(swapChainExtent.width, swapChainExtent.height, 1, msaaSamples, colorFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, colorImage, colorImageMemory);
-        colorImageView = createImageView(colorImage, colorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
-
-        transitionImageLayout(colorImage, colorFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 1);
-    }
-
-    void createDepthResources()
+    // Lazily allocated memory is only committed once the device needs it, which it reports per memory object
+    void printRenderGraphStatistics()
     {
-        VkFormat depthFormat = findDepthFormat();
-        createImage(swapChainExtent.width, swapChainExtent.height, 1, msaaSamples, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory);
-        depthImageView = createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
-        transitionImageLayout(depthImage, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, 1);
-
+        const RenderGraphStats stats = renderGraph->stats();
 
+        std::cout << "Render graph at " << swapChainExtent.width << "x" << swapChainExtent.height << ", " << msaaSamples << "x MSAA: "
+                  << stats.passCount - stats.culledPassCount << " of " << stats.passCount << " pass(es), " << stats.imageCount << " image(s), "
+                  << stats.barrierCount << " barrier(s) in " << stats.barrierBatchCount << " batch(es) per frame" << std::endl;
+        std::cout << "\t" << stats.imageBytes / 1024 << " KiB of images in " << stats.memoryBytes / 1024 << " KiB after aliasing";
+        if (stats.lazilyAllocated)
+        {
+            const VkDeviceSize committed = renderGraph->committedBytes();
+            std::cout << ", " << committed / 1024 << " KiB committed, " << (stats.memoryBytes - std::min(stats.memoryBytes, committed)) / 1024 << " KiB saved" << std::endl;
+        }
+        else
+        {
+            std::cout << ", no lazily allocated memory, all of it committed" << std::endl;
+        }
     }
 
     void generateMipmaps(VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels)
@@ -1444,7 +2299,7 @@ private:
         }
 
 
-        VkCommandBuffer commandBuffer           = beginSingleTimeCommands();
+        VkCommandBuffer commandBuffer           = stagingRing->commandBuffer();
 
         VkImageMemoryBarrier barrier            = {};
         barrier.sType                           = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -1519,49 +2374,674 @@ private:
             0, nullptr,
             0, nullptr,
             1, &barrier);
-
-
-        endSingleTimeCommands(commandBuffer);
     }
 
-    void createTextureImage()
+    // Runs before the device exists, so it only reads files and decodes
+    void loadTextureSource()
     {
-        int texWidth, texHeight, texChannels;
-        stbi_uc* pixels = stbi_load(TEXTURE_PATH.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-        VkDeviceSize imageSize = texWidth * texHeight * 4;
-
-        if (!pixels)
+        textureSource = std::make_unique<TextureSource>();
+        TextureSource& source = *textureSource;
+        if (!source.file.open(TEXTURE_PATH))
         {
             throw std::runtime_error("failed to load texture image!");
         }
+        source.hash      = hashBytes(source.file.data(), source.file.size());
+        source.cachePath = TEXTURE_PATH + ".texcache";
 
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-        createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+        auto cached = std::make_unique<TextureLevels>();
+        if (usesTextureCache() && openTextureCache(source.cachePath, source.hash, *cached))
+        {
+            source.cached = std::move(cached);
+            return;
+        }
 
-        void* data;
-        vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-        memcpy(data, pixels, static_cast<size_t>(imageSize));
-        vkUnmapMemory(device, stagingBufferMemory);
-        stbi_image_free(pixels);
+        const bool compressedFile = settings.textureFormat != TextureFormat::Rgba8 &&
+                                    (std::ifstream(TEXTURE_PATH + ".bc7").good() || std::ifstream(TEXTURE_PATH + ".bc1").good());
+        if (!compressedFile && !settings.textureStreaming)
+        {
+            source.decoded = decodeImage(source.file);
+        }
+    }
 
-        mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
+    static DecodedImage decodeImage(const MappedFile& file)
+    {
+        DecodedImage image;
+        int          channels;
+        image.pixels.reset(stbi_load_from_memory(file.data(), static_cast<int>(file.size()), &image.width, &image.height, &channels, STBI_rgb_alpha));
+        if (!image.pixels)
+        {
+            throw std::runtime_error("failed to load texture image!");
+        }
+        return image;
+    }
 
-        createImage(texWidth, texHeight, mipLevels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
-        transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
-        copyBufferToImage(stagingBuffer, textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
-        //transitioned to VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL while generating mipmaps
+    void createTextureImage()
+    {
+        // loadTextureSource ran before, its results are only needed here
+        const std::unique_ptr<TextureSource> loaded     = std::move(textureSource);
+        const uint64_t                       sourceHash = loaded->hash;
+        const std::string                    cachePath  = loaded->cachePath;
+
+        // Compressed textures and the cache hold the whole chain, otherwise the source still has to be decoded
+        auto texture       = std::make_unique<TextureLevels>();
+        textureImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+        bool hasChain      = settings.textureFormat != TextureFormat::Rgba8 && openCompressedTexture(sourceHash, *texture);
+        if (!hasChain && loaded->cached)
+        {
+            texture  = std::move(loaded->cached);
+            hasChain = true;
+        }
 
-        vkDestroyBuffer(device, stagingBuffer, nullptr);
-        vkFreeMemory(device, stagingBufferMemory, nullptr);
+        // Blitting needs the graphics queue, so only chains built on the CPU can be streamed
+        if (settings.textureStreaming && (hasChain || usesCpuMipmaps()))
+        {
+            startTextureStreaming(std::move(loaded->file), std::move(texture), cachePath, sourceHash);
+        }
+        else if (hasChain)
+        {
+            createTextureImageFromLevels(*texture);
+        }
+        else
+        {
+            createUncompressedTextureImage(*loaded);
+        }
 
-        generateMipmaps(textureImage,  VK_FORMAT_R8G8B8A8_UNORM, texWidth, texHeight, mipLevels);
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(device, textureImage, &memRequirements);
 
+        const char* formatName = textureImageFormat == VK_FORMAT_BC7_UNORM_BLOCK ? "BC7" : textureImageFormat == VK_FORMAT_BC1_RGB_UNORM_BLOCK ? "BC1" : "RGBA8";
+        std::cout << "Texture " << TEXTURE_PATH << " uses " << formatName << " with " << mipLevels << " mip levels, "
+                  << memRequirements.size / 1024 << " KiB of device memory" << std::endl;
+    }
+
+    bool supportsLinearBlit(VkFormat format)
+    {
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &formatProperties);
+        return (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) != 0;
+    }
+
+    // Maps the mip chain textureEncoder wrote next to the texture, false if there is none usable
+    bool openCompressedTexture(uint64_t sourceHash, TextureLevels& texture)
+    {
+        if (!textureCompressionBC)
+        {
+            std::cout << "Device does not support BC texture compression, using RGBA8" << std::endl;
+            return false;
+        }
+
+        std::vector<VkFormat> candidates;
+        if (settings.textureFormat != TextureFormat::Bc1)
+        {
+            candidates.push_back(VK_FORMAT_BC7_UNORM_BLOCK);
+        }
+        if (settings.textureFormat != TextureFormat::Bc7)
+        {
+            candidates.push_back(VK_FORMAT_BC1_RGB_UNORM_BLOCK);
+        }
+        const VkFormat         format           = findSupportedFormat(candidates, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT);
+        const CompressedFormat compressedFormat = format == VK_FORMAT_BC7_UNORM_BLOCK ? CompressedFormat::BC7 : CompressedFormat::BC1;
+        const std::string      path             = TEXTURE_PATH + (compressedFormat == CompressedFormat::BC7 ? ".bc7" : ".bc1");
+
+        MappedFile file;
+        if (!file.open(path))
+        {
+            std::cout << "No compressed texture " << path << ", using RGBA8" << std::endl;
+            return false;
+        }
+
+        CompressedTextureHeader       header;
+        const CompressedTextureLevel* levels = parseCompressedTexture(file.data(), file.size(), header);
+        if (!levels || header.format != static_cast<uint32_t>(compressedFormat) || header.sourceHash != sourceHash)
+        {
+            std::cout << "Ignoring outdated compressed texture " << path << ", using RGBA8" << std::endl;
+            return false;
+        }
+
+        assignTextureFile(std::move(file), header, levels, texture);
+        textureImageFormat = format;
+        return true;
+    }
+
+    bool openTextureCache(const std::string& cachePath, uint64_t sourceHash, TextureLevels& texture)
+    {
+        MappedFile cache;
+        if (!cache.open(cachePath))
+        {
+            return false;
+        }
+
+        CompressedTextureHeader       header;
+        const CompressedTextureLevel* levels = parseCompressedTexture(cache.data(), cache.size(), header);
+
+        bool isValid = levels != nullptr;
+        isValid = isValid && header.format == static_cast<uint32_t>(CompressedFormat::RGBA8);
+        isValid = isValid && header.mipFilter == static_cast<uint32_t>(settings.mipFilter);
+        isValid = isValid && header.sourceHash == sourceHash;
+        if (!isValid)
+        {
+            std::cout << "Ignoring outdated texture cache " << cachePath << std::endl;
+            return false;
+        }
+
+        std::cout << "Loading texture " << TEXTURE_PATH << " from " << cachePath << std::endl;
+        assignTextureFile(std::move(cache), header, levels, texture);
+        return true;
+    }
+
+    // The levels point into the mapping, which moves along without changing its address
+    void assignTextureFile(MappedFile file, const CompressedTextureHeader& header, const CompressedTextureLevel* levels, TextureLevels& texture)
+    {
+        texture.levels.resize(header.levelCount);
+        for (uint32_t level = 0; level < header.levelCount; level++)
+        {
+            texture.levels[level].data   = file.data() + levels[level].offset;
+            texture.levels[level].size   = static_cast<size_t>(levels[level].size);
+            texture.levels[level].width  = levels[level].width;
+            texture.levels[level].height = levels[level].height;
+        }
+        texture.file = std::move(file);
+    }
+
+    // Filters the chain of the decoded source image on the given pool, decoding it first when that did not
+    // happen yet. Only touches texture and the cache file, so the texture streamer can call it while the main
+    // thread goes on.
+    void decodeTextureLevels(const MappedFile& source, DecodedImage decoded, const std::string& cachePath, uint64_t sourceHash, TextureLevels& texture, ThreadPool& pool)
+    {
+        const auto start = std::chrono::high_resolution_clock::now();
+
+        if (!decoded.pixels)
+        {
+            decoded = decodeImage(source);
+        }
+        const int texWidth  = decoded.width;
+        const int texHeight = decoded.height;
+
+        const uint32_t                    levelCount = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
+        const std::vector<MipLevelLayout> layout     = computeMipChainLayout(texWidth, texHeight, levelCount);
+
+        // The texture is sRGB encoded even though it is sampled as UNORM, so averaging has to happen in linear space
+        texture.chain.resize(mipChainSize(layout));
+        memcpy(texture.chain.data(), decoded.pixels.get(), layout[0].size);
+        decoded.pixels.reset();
+        generateMipChain(texture.chain.data(), texture.chain.data(), layout, settings.mipFilter, true, pool);
+
+        texture.levels.resize(levelCount);
+        for (uint32_t level = 0; level < levelCount; level++)
+        {
+            texture.levels[level].data   = texture.chain.data() + layout[level].offset;
+            texture.levels[level].size   = layout[level].size;
+            texture.levels[level].width  = layout[level].width;
+            texture.levels[level].height = layout[level].height;
+        }
+
+        const double totalMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        std::cout << "Decoded texture " << TEXTURE_PATH << " and generated " << levelCount << " mip levels on the CPU (" << (settings.mipFilter == MipFilter::Box ? "box" : "kaiser")
+                  << ", " << pool.size() << " threads) in " << totalMs << " ms" << std::endl;
+
+        if (usesTextureCache() && !writeTextureCache(cachePath, sourceHash, layout, texture.chain.data()))
+        {
+            std::cerr << "failed to write texture cache " << cachePath << std::endl;
+        }
+    }
+
+    // Regions of levels [firstLevel, endLevel) packed back to back at 16 byte aligned offsets, which suits every
+    // block size. Returns the size of the staging buffer they need.
+    VkDeviceSize textureLevelRegions(const TextureLevels& texture, uint32_t firstLevel, uint32_t endLevel, std::vector<VkBufferImageCopy>& regions)
+    {
+        VkDeviceSize offset = 0;
+        regions.clear();
+        for (uint32_t level = firstLevel; level < endLevel; level++)
+        {
+            VkBufferImageCopy region               = {};
+            region.bufferOffset                    = offset;
+            region.bufferRowLength                 = 0;
+            region.bufferImageHeight               = 0;
+            region.imageSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.imageSubresource.mipLevel       = level;
+            region.imageSubresource.baseArrayLayer = 0;
+            region.imageSubresource.layerCount     = 1;
+            region.imageOffset                     = {0, 0, 0};
+            region.imageExtent                     = {texture.levels[level].width, texture.levels[level].height, 1};
+            regions.push_back(region);
+
+            offset = (offset + texture.levels[level].size + 15) / 16 * 16;
+        }
+        return regions.empty() ? 0 : regions.back().bufferOffset + texture.levels[endLevel - 1].size;
+    }
+
+    void copyTextureLevels(const TextureLevels& texture, const std::vector<VkBufferImageCopy>& regions, void* staging)
+    {
+        for (const VkBufferImageCopy& region : regions)
+        {
+            const TextureLevelData& level = texture.levels[region.imageSubresource.mipLevel];
+            memcpy(static_cast<uint8_t*>(staging) + region.bufferOffset, level.data, level.size);
+        }
+    }
+
+    // Uploads every level with a single copy through the staging ring
+    void createTextureImageFromLevels(const TextureLevels& texture)
+    {
+        mipLevels = static_cast<uint32_t>(texture.levels.size());
+
+        std::vector<VkBufferImageCopy> regions;
+        const VkDeviceSize             stagingSize = textureLevelRegions(texture, 0, mipLevels, regions);
+        const StagingAllocation        staging     = stagingRing->allocate(stagingSize);
+
+        copyTextureLevels(texture, regions, staging.data);
+        for (VkBufferImageCopy& region : regions)
+        {
+            region.bufferOffset += staging.offset;
+        }
+
+        createImage(texture.levels[0].width, texture.levels[0].height, mipLevels, VK_SAMPLE_COUNT_1_BIT, textureImageFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
+        transitionImageLayout(textureImage, textureImageFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
+        copyBufferToImage(staging.buffer, textureImage, regions);
+        transitionImageLayout(textureImage, textureImageFormat, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevels);
+    }
+
+    // Blitted levels never reach host memory, so only chains filtered on the CPU are cached. Asking for the GPU
+    // explicitly turns the cache off instead of being overruled by it.
+    bool usesTextureCache() const
+    {
+        return settings.textureCache && settings.mipmaps != MipmapGeneration::Gpu;
+    }
+
+    bool prefersGpuMipmaps() const
+    {
+        return settings.mipmaps == MipmapGeneration::Gpu || (settings.mipmaps == MipmapGeneration::Auto && !settings.textureCache);
+    }
+
+    bool usesCpuMipmaps()
+    {
+        return !prefersGpuMipmaps() || !supportsLinearBlit(VK_FORMAT_R8G8B8A8_UNORM);
+    }
+
+    void createUncompressedTextureImage(TextureSource& source)
+    {
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        if (prefersGpuMipmaps() && !supportsLinearBlit(VK_FORMAT_R8G8B8A8_UNORM))
+        {
+            std::cout << "Texture format does not support linear blitting, generating mipmaps on the CPU" << std::endl;
+        }
+
+        if (usesCpuMipmaps())
+        {
+            TextureLevels texture;
+            decodeTextureLevels(source.file, std::move(source.decoded), source.cachePath, source.hash, texture, *threadPool);
+            createTextureImageFromLevels(texture);
+
+            const float coldMs = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - startTime).count();
+            std::cout << "\tcold start: decoded " << (usesTextureCache() ? "and cached " : "") << "in " << coldMs << " ms" << std::endl;
+            return;
+        }
+
+        if (!source.decoded.pixels)
+        {
+            source.decoded = decodeImage(source.file);
+        }
+        const int texWidth  = source.decoded.width;
+        const int texHeight = source.decoded.height;
+
+        mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
+
+        VkDeviceSize imageSize = texWidth * texHeight * 4;
+
+        const StagingAllocation staging = stagingRing->allocate(imageSize);
+        memcpy(staging.data, source.decoded.pixels.get(), static_cast<size_t>(imageSize));
+        source.decoded.pixels.reset();
+
+        createImage(texWidth, texHeight, mipLevels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
+        transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
+        copyBufferToImage(staging.buffer, staging.offset, textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
+        //transitioned to VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL while generating mipmaps
+
+        generateMipmaps(textureImage,  VK_FORMAT_R8G8B8A8_UNORM, texWidth, texHeight, mipLevels);
+
+    }
+
+    bool writeTextureCache(const std::string& cachePath, uint64_t sourceHash, const std::vector<MipLevelLayout>& layout, const uint8_t* chain)
+    {
+        CompressedTextureHeader header = {};
+        memcpy(header.magic, COMPRESSED_TEXTURE_MAGIC, sizeof(header.magic));
+        header.version    = COMPRESSED_TEXTURE_VERSION;
+        header.format     = static_cast<uint32_t>(CompressedFormat::RGBA8);
+        header.width      = layout[0].width;
+        header.height     = layout[0].height;
+        header.levelCount = static_cast<uint32_t>(layout.size());
+        header.mipFilter  = static_cast<uint32_t>(settings.mipFilter);
+        header.sourceHash = sourceHash;
+
+        // Both layouts align every level to 16 bytes, so the chain is written as it is
+        return writeCompressedTexture(cachePath, header, layoutCompressedTexture(header, layout), chain);
+    }
+
+    // Creates the image for the whole chain and leaves decoding and uploading to the texture streamer thread.
+    // Until its first levels arrive the descriptors point at a 1x1 placeholder.
+    void startTextureStreaming(MappedFile source, std::unique_ptr<TextureLevels> texture, const std::string& cachePath, uint64_t sourceHash)
+    {
+        uint32_t texWidth, texHeight;
+        if (!texture->levels.empty())
+        {
+            texWidth  = texture->levels[0].width;
+            texHeight = texture->levels[0].height;
+            mipLevels = static_cast<uint32_t>(texture->levels.size());
+        }
+        else
+        {
+            int width, height, channels;
+            if (!stbi_info_from_memory(source.data(), static_cast<int>(source.size()), &width, &height, &channels))
+            {
+                throw std::runtime_error("failed to load texture image!");
+            }
+            texWidth  = static_cast<uint32_t>(width);
+            texHeight = static_cast<uint32_t>(height);
+            mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+        }
+
+        createImage(texWidth, texHeight, mipLevels, VK_SAMPLE_COUNT_1_BIT, textureImageFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
+        createPlaceholderTexture();
+        residentTextureLevel = mipLevels;
+
+        std::cout << "Streaming texture " << TEXTURE_PATH << " on queue family " << transferQueueFamily
+                  << (transferQueueFamily != graphicsQueueFamily ? " (dedicated transfer)" : " (graphics)") << std::endl;
+
+        textureStreamer = std::thread([this, source = std::move(source), texture = std::move(texture), cachePath, sourceHash]()
+        {
+            try
+            {
+                streamTexture(source, cachePath, sourceHash, *texture);
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << "texture streaming failed: " << e.what() << std::endl;
+            }
+        });
+    }
+
+    void createPlaceholderTexture()
+    {
+        const uint8_t grey[4] = {128, 128, 128, 255};
+
+        const StagingAllocation staging = stagingRing->allocate(sizeof(grey));
+        memcpy(staging.data, grey, sizeof(grey));
+
+        createImage(1, 1, 1, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, placeholderImage, placeholderImageMemory);
+        transitionImageLayout(placeholderImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1);
+        copyBufferToImage(staging.buffer, staging.offset, placeholderImage, 1, 1);
+        transitionImageLayout(placeholderImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1);
+
+        placeholderImageView = createImageView(placeholderImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+    }
+
+    // Runs on the texture streamer thread. Batches go from coarse to fine, each one leaves a usable mip tail
+    // behind: first every level up to 64x64 texels, then one level at a time.
+    void streamTexture(const MappedFile& source, const std::string& cachePath, uint64_t sourceHash, TextureLevels& texture)
+    {
+        // Batches of the shared pool take turns, so work the main thread puts on it meanwhile waits for the
+        // filtering instead of competing with a second set of threads for the cores
+        if (texture.levels.empty())
+        {
+            decodeTextureLevels(source, DecodedImage(), cachePath, sourceHash, texture, *threadPool);
+        }
+
+        VkCommandPoolCreateInfo poolInfo = {};
+        poolInfo.sType                   = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex        = transferQueueFamily;
+        poolInfo.flags                   = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+        VkCommandPool transferCommandPool;
+        if (vkCreateCommandPool(device, &poolInfo, nullptr, &transferCommandPool) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create transfer command pool!");
+        }
+
+        VkFenceCreateInfo fenceInfo = {};
+        fenceInfo.sType             = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+        VkFence uploadFence;
+        if (vkCreateFence(device, &fenceInfo, nullptr, &uploadFence) != VK_SUCCESS)
+        {
+            vkDestroyCommandPool(device, transferCommandPool, nullptr);
+            throw std::runtime_error("failed to create texture upload fence!");
+        }
+
+        uint32_t endLevel = mipLevels;
+        while (endLevel > 0 && !stopTextureStreaming)
+        {
+            uint32_t firstLevel = endLevel - 1;
+            while (firstLevel > 0 && texture.levels[firstLevel - 1].width <= 64 && texture.levels[firstLevel - 1].height <= 64)
+            {
+                firstLevel--;
+            }
+
+            uploadTextureLevels(texture, firstLevel, endLevel, transferCommandPool, uploadFence);
+            endLevel = firstLevel;
+        }
+
+        vkDestroyFence(device, uploadFence, nullptr);
+        vkDestroyCommandPool(device, transferCommandPool, nullptr);
+    }
+
+    VkImageMemoryBarrier textureLevelBarrier(uint32_t firstLevel, uint32_t levelCount, VkImageLayout oldLayout, VkImageLayout newLayout)
+    {
+        VkImageMemoryBarrier barrier            = {};
+        barrier.sType                           = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout                       = oldLayout;
+        barrier.newLayout                       = newLayout;
+        barrier.srcQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image                           = textureImage;
+        barrier.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel   = firstLevel;
+        barrier.subresourceRange.levelCount     = levelCount;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount     = 1;
+        return barrier;
+    }
+
+    // Copies levels [firstLevel, endLevel) on the transfer queue and releases them to the graphics queue family.
+    // The batch is handed to the render loop with the semaphore its submission signals.
+    void uploadTextureLevels(const TextureLevels& texture, uint32_t firstLevel, uint32_t endLevel, VkCommandPool transferCommandPool, VkFence uploadFence)
+    {
+        std::vector<VkBufferImageCopy> regions;
+        const VkDeviceSize             stagingSize = textureLevelRegions(texture, firstLevel, endLevel, regions);
+
+        VkBuffer stagingBuffer;
+        DeviceAllocation stagingBufferMemory;
+        createBuffer(stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+        void* data = stagingBufferMemory.mapped;
+        copyTextureLevels(texture, regions, data);
+
+        VkCommandBufferAllocateInfo allocInfo = {};
+        allocInfo.sType                       = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level                       = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandPool                 = transferCommandPool;
+        allocInfo.commandBufferCount          = 1;
+
+        VkCommandBuffer commandBuffer;
+        vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType                    = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags                    = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+        const uint32_t levelCount = endLevel - firstLevel;
+
+        VkImageMemoryBarrier barrier = textureLevelBarrier(firstLevel, levelCount, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        barrier.srcAccessMask        = 0;
+        barrier.dstAccessMask        = VK_ACCESS_TRANSFER_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, textureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+
+        // Release half of the ownership transfer, the graphics queue acquires the levels with the same barrier
+        barrier = textureLevelBarrier(firstLevel, levelCount, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = 0;
+        if (transferQueueFamily != graphicsQueueFamily)
+        {
+            barrier.srcQueueFamilyIndex = transferQueueFamily;
+            barrier.dstQueueFamilyIndex = graphicsQueueFamily;
+        }
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        vkEndCommandBuffer(commandBuffer);
+
+        VkSemaphoreCreateInfo semaphoreInfo = {};
+        semaphoreInfo.sType                 = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+        VkSemaphore uploaded;
+        if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &uploaded) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to create texture upload semaphore!");
+        }
+
+        VkSubmitInfo submitInfo         = {};
+        submitInfo.sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount   = 1;
+        submitInfo.pCommandBuffers      = &commandBuffer;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores    = &uploaded;
+
+        VkResult result;
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            result = vkQueueSubmit(transferQueue, 1, &submitInfo, uploadFence);
+        }
+        if (result != VK_SUCCESS)
+        {
+            vkDestroySemaphore(device, uploaded, nullptr);
+            throw std::runtime_error("failed to submit texture upload!");
+        }
+
+        // The staging buffer is small enough to wait for, and the batches reach the renderer in order
+        vkWaitForFences(device, 1, &uploadFence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+        vkResetFences(device, 1, &uploadFence);
+
+        vkFreeCommandBuffers(device, transferCommandPool, 1, &commandBuffer);
+        vkDestroyBuffer(device, stagingBuffer, nullptr);
+        memoryAllocator->free(stagingBufferMemory);
+
+        StreamedTextureLevels streamed;
+        streamed.firstLevel = firstLevel;
+        streamed.levelCount = levelCount;
+        streamed.uploaded   = uploaded;
+
+        std::lock_guard<std::mutex> lock(streamedLevelsMutex);
+        streamedLevels.push_back(streamed);
+    }
+
+    // Picks up batches the texture streamer finished. The next frame waits for their semaphores and acquires
+    // ownership before sampling, from then on the view starting at the finest resident level is bound.
+    void acquireStreamedTextureLevels(std::vector<VkSemaphore>& waitSemaphores, std::vector<VkPipelineStageFlags>& waitStages, std::vector<VkCommandBuffer>& submitCommandBuffers)
+    {
+        std::vector<StreamedTextureLevels> finished;
+        {
+            std::lock_guard<std::mutex> lock(streamedLevelsMutex);
+            finished.swap(streamedLevels);
+        }
+        if (finished.empty())
+        {
+            return;
+        }
+
+        for (const StreamedTextureLevels& levels : finished)
+        {
+            waitSemaphores.push_back(levels.uploaded);
+            waitStages.push_back(VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+            frameUploadSemaphores[currentFrame].push_back(levels.uploaded);
+
+            if (transferQueueFamily != graphicsQueueFamily)
+            {
+                VkCommandBufferAllocateInfo allocInfo = {};
+                allocInfo.sType                       = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+                allocInfo.level                       = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+                allocInfo.commandPool                 = commandPool;
+                allocInfo.commandBufferCount          = 1;
+
+                VkCommandBuffer commandBuffer;
+                vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+
+                VkCommandBufferBeginInfo beginInfo = {};
+                beginInfo.sType                    = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+                beginInfo.flags                    = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+                vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+                VkImageMemoryBarrier barrier = textureLevelBarrier(levels.firstLevel, levels.levelCount, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+                barrier.srcAccessMask        = 0;
+                barrier.dstAccessMask        = VK_ACCESS_SHADER_READ_BIT;
+                barrier.srcQueueFamilyIndex  = transferQueueFamily;
+                barrier.dstQueueFamilyIndex  = graphicsQueueFamily;
+                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+                vkEndCommandBuffer(commandBuffer);
+
+                submitCommandBuffers.push_back(commandBuffer);
+                frameAcquireCommandBuffers[currentFrame].push_back(commandBuffer);
+            }
+
+            residentTextureLevel = std::min(residentTextureLevel, levels.firstLevel);
+        }
+
+        textureImageView = textureLevelViews[residentTextureLevel];
+
+        if (residentTextureLevel == 0)
+        {
+            const float residentMs = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - launchTime).count();
+            std::cout << "Texture " << TEXTURE_PATH << " fully resident after " << residentMs << " ms" << std::endl;
+        }
+    }
+
+    // Semaphores and acquire command buffers of a frame are done with once its fence signalled
+    void releaseFrameUploads(size_t frame)
+    {
+        for (VkSemaphore semaphore : frameUploadSemaphores[frame])
+        {
+            vkDestroySemaphore(device, semaphore, nullptr);
+        }
+        frameUploadSemaphores[frame].clear();
+
+        if (!frameAcquireCommandBuffers[frame].empty())
+        {
+            vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(frameAcquireCommandBuffers[frame].size()), frameAcquireCommandBuffers[frame].data());
+            frameAcquireCommandBuffers[frame].clear();
+        }
+    }
+
+    void stopTextureStreamer()
+    {
+        stopTextureStreaming = true;
+        if (textureStreamer.joinable())
+        {
+            textureStreamer.join();
+        }
+
+        // Batches nobody picked up any more, their submissions completed before the streamer returned
+        for (const StreamedTextureLevels& levels : streamedLevels)
+        {
+            vkDestroySemaphore(device, levels.uploaded, nullptr);
+        }
+        streamedLevels.clear();
     }
 
     void createTextureImageView()
     {
-        textureImageView = createImageView(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
+        if (placeholderImage == VK_NULL_HANDLE)
+        {
+            textureImageView = createImageView(textureImage, textureImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
+            return;
+        }
+
+        // One view per resident mip tail, the sampler never reads a level that is still being uploaded
+        for (uint32_t level = 0; level < mipLevels; level++)
+        {
+            textureLevelViews.push_back(createImageView(textureImage, textureImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels - level, level));
+        }
+        textureImageView = placeholderImageView;
     }
 
     void createTextureSampler()
@@ -1586,29 +3066,318 @@ private:
 
         if (vkCreateSampler(device, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS)
         {
-            throw std::runtime_error("failed to create texture sampler!");
+            throw std::runtime_error("failed to create texture sampler!");
+        }
+    }
+
+    void loadModel()
+    {
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        MappedFile source;
+        if (!source.open(MODEL_PATH))
+        {
+            throw std::runtime_error("failed to open model " + MODEL_PATH);
+        }
+        const uint64_t sourceHash = hashBytes(source.data(), source.size());
+        source.close();
+
+        const std::string cachePath = MODEL_PATH + ".meshcache";
+        if (settings.meshCache && loadMeshCache(cachePath, sourceHash))
+        {
+            const float warmMs = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - startTime).count();
+            std::cout << "Loaded model " << MODEL_PATH << " using " << meshVertices.count << " vertices" << std::endl;
+            std::cout << "\twarm start: mapped " << cachePath << " in " << warmMs << " ms" << std::endl;
+            return;
+        }
+
+        parseModel();
+        if (settings.meshOptimization != MeshOptimization::None)
+        {
+            optimizeMesh();
+        }
+        buildLodChain();
+        if (settings.meshOptimization != MeshOptimization::None)
+        {
+            // Renumber last, so the fetch order follows the full mesh and all levels keep sharing the vertices
+            optimizeVertexFetch(vertices, indices);
+        }
+
+        meshVertices = {vertices.data(), vertices.size()};
+        meshIndices  = {indices.data(), indices.size()};
+
+        if (settings.meshCache && !writeMeshCache(cachePath, sourceHash))
+        {
+            std::cerr << "failed to write mesh cache " << cachePath << std::endl;
+        }
+
+        const float coldMs = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - startTime).count();
+        std::cout << "\tcold start: loaded " << (settings.meshCache ? "and cached " : "") << "in " << coldMs << " ms" << std::endl;
+    }
+
+    bool loadMeshCache(const std::string& cachePath, uint64_t sourceHash)
+    {
+        MappedFile cache;
+        if (!cache.open(cachePath) || cache.size() < sizeof(MeshCacheHeader))
+        {
+            return false;
+        }
+
+        MeshCacheHeader header;
+        memcpy(&header, cache.data(), sizeof(header));
+
+        bool isValid = true;
+        isValid &= memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic)) == 0;
+        isValid &= header.version == MESH_CACHE_VERSION;
+        isValid &= header.vertexLayout == Vertex::layoutKey();
+        isValid &= header.meshOptimization == static_cast<uint32_t>(settings.meshOptimization);
+        isValid &= header.lodLevels == settings.lodLevels;
+        isValid &= header.sourceHash == sourceHash;
+        isValid &= header.vertexOffset % alignof(Vertex) == 0 && header.indexOffset % alignof(uint32_t) == 0;
+        isValid &= header.vertexOffset + uint64_t(header.vertexCount) * sizeof(Vertex) <= cache.size();
+        isValid &= header.indexOffset + uint64_t(header.indexCount) * sizeof(uint32_t) <= cache.size();
+        isValid &= header.lodOffset % alignof(MeshLod) == 0 && header.lodCount > 0;
+        isValid &= header.lodOffset + uint64_t(header.lodCount) * sizeof(MeshLod) <= cache.size();
+        if (!isValid)
+        {
+            std::cout << "Ignoring outdated mesh cache " << cachePath << std::endl;
+            return false;
+        }
+
+        meshCacheFile = std::move(cache);
+        meshVertices  = {reinterpret_cast<const Vertex*>(meshCacheFile.data() + header.vertexOffset), header.vertexCount};
+        meshIndices   = {reinterpret_cast<const uint32_t*>(meshCacheFile.data() + header.indexOffset), header.indexCount};
+
+        const MeshLod* cachedLods = reinterpret_cast<const MeshLod*>(meshCacheFile.data() + header.lodOffset);
+        lods.assign(cachedLods, cachedLods + header.lodCount);
+        for (const MeshLod& lod : lods)
+        {
+            if (uint64_t(lod.firstIndex) + lod.indexCount > header.indexCount)
+            {
+                std::cout << "Ignoring outdated mesh cache " << cachePath << std::endl;
+                meshCacheFile.close();
+                lods.clear();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool writeMeshCache(const std::string& cachePath, uint64_t sourceHash)
+    {
+        const uint64_t alignment = 16;
+        auto alignUp = [&](uint64_t offset) { return (offset + alignment - 1) / alignment * alignment; };
+
+        MeshCacheHeader header = {};
+        memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+        header.version          = MESH_CACHE_VERSION;
+        header.vertexLayout     = Vertex::layoutKey();
+        header.meshOptimization = static_cast<uint32_t>(settings.meshOptimization);
+        header.lodLevels        = settings.lodLevels;
+        header.sourceHash       = sourceHash;
+        header.vertexCount      = static_cast<uint32_t>(meshVertices.count);
+        header.indexCount       = static_cast<uint32_t>(meshIndices.count);
+        header.lodCount         = static_cast<uint32_t>(lods.size());
+        header.vertexOffset     = alignUp(sizeof(header));
+        header.indexOffset      = alignUp(header.vertexOffset + meshVertices.byteSize());
+        header.lodOffset        = alignUp(header.indexOffset + meshIndices.byteSize());
+
+        return writeFileAtomically(cachePath, [&](std::ofstream& file)
+        {
+            const char padding[alignment] = {};
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(padding, header.vertexOffset - sizeof(header));
+            file.write(reinterpret_cast<const char*>(meshVertices.data), meshVertices.byteSize());
+            file.write(padding, header.indexOffset - header.vertexOffset - meshVertices.byteSize());
+            file.write(reinterpret_cast<const char*>(meshIndices.data), meshIndices.byteSize());
+            file.write(padding, header.lodOffset - header.indexOffset - meshIndices.byteSize());
+            file.write(reinterpret_cast<const char*>(lods.data()), lods.size() * sizeof(MeshLod));
+        });
+    }
+
+    void parseModel()
+    {
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        tinyobj::attrib_t attrib;
+        std::vector<tinyobj::shape_t> shapes;
+        std::vector<tinyobj::material_t> materials;
+        std::string err;
+
+        if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, MODEL_PATH.c_str()))
+        {
+            throw std::runtime_error(err);
+        }
+
+        auto parseTime = std::chrono::high_resolution_clock::now();
+
+        // Flatten all shapes into one index stream, so work can be split independent of the shape layout
+        std::vector<tinyobj::index_t> objIndices;
+        for (const auto& shape : shapes)
+        {
+            objIndices.insert(objIndices.end(), shape.mesh.indices.begin(), shape.mesh.indices.end());
+        }
+
+        deduplicateVertices(attrib, objIndices);
+
+        auto endTime = std::chrono::high_resolution_clock::now();
+
+        const float parseMs = std::chrono::duration<float, std::chrono::milliseconds::period>(parseTime - startTime).count();
+        const float dedupMs = std::chrono::duration<float, std::chrono::milliseconds::period>(endTime - parseTime).count();
+        const float totalMs = std::chrono::duration<float, std::chrono::milliseconds::period>(endTime - startTime).count();
+
+        std::cout << "Loaded model " << MODEL_PATH << " using " << vertices.size() << " vertices" << std::endl;
+        std::cout << "\tparse " << parseMs << " ms, deduplicate " << dedupMs << " ms (" << threadPool->size() << " threads), total " << totalMs << " ms" << std::endl;
+        std::cout << "\t" << (indices.size() / std::max(dedupMs, 0.001f) / 1000.0f) << " M indices/s deduplicated, "
+                  << (indices.size() / std::max(totalMs, 0.001f) / 1000.0f) << " M indices/s overall" << std::endl;
+    }
+
+    // Appends simplified copies of the full mesh to indices, each level aiming at half the triangles of the previous one
+    void buildLodChain()
+    {
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        const size_t baseIndexCount = indices.size();
+        std::vector<std::vector<uint32_t>> lodIndices(settings.lodLevels - 1);
+        std::vector<float>                 lodErrors(settings.lodLevels - 1);
+
+        // Every level starts from the full mesh, so its error is measured against the original surface
+        threadPool->parallelTasks(lodIndices.size(), [&](size_t level)
+        {
+            const size_t targetIndexCount = (baseIndexCount >> (level + 1)) / 3 * 3;
+            lodIndices[level] = simplifyMesh(indices.data(), baseIndexCount, &vertices[0].pos.x, sizeof(Vertex), vertices.size(), targetIndexCount, lodErrors[level]);
+
+            if (settings.meshOptimization != MeshOptimization::None)
+            {
+                std::vector<uint32_t> optimized(lodIndices[level].size());
+                optimizeVertexCache(optimized.data(), lodIndices[level].data(), lodIndices[level].size(), vertices.size(), VERTEX_CACHE_SIZE);
+                lodIndices[level].swap(optimized);
+            }
+        });
+
+        lods.clear();
+        lods.push_back({0, static_cast<uint32_t>(baseIndexCount), 0.0f});
+        for (size_t level = 0; level < lodIndices.size(); level++)
+        {
+            lods.push_back({static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(lodIndices[level].size()), lodErrors[level]});
+            indices.insert(indices.end(), lodIndices[level].begin(), lodIndices[level].end());
+        }
+
+        const float simplifyMs = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - startTime).count();
+        std::cout << "\tbuilt " << lodIndices.size() << " simplified levels in " << simplifyMs << " ms" << std::endl;
+    }
+
+    // Bounding sphere for LOD selection and, with culling enabled, the meshlets of every level
+    void prepareLods()
+    {
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        // A model without faces has no bounds and nothing to cull
+        meshlets.clear();
+        if (meshVertices.count == 0 || meshIndices.count == 0)
+        {
+            std::cout << "\tempty mesh, no levels of detail or meshlets prepared" << std::endl;
+            return;
+        }
+
+        glm::vec3 minimum = meshVertices.data[0].pos;
+        glm::vec3 maximum = meshVertices.data[0].pos;
+        for (size_t i = 0; i < meshVertices.count; i++)
+        {
+            minimum = glm::min(minimum, meshVertices.data[i].pos);
+            maximum = glm::max(maximum, meshVertices.data[i].pos);
+        }
+        meshCenter = (minimum + maximum) * 0.5f;
+        meshRadius = 0.0f;
+        for (size_t i = 0; i < meshVertices.count; i++)
+        {
+            meshRadius = std::max(meshRadius, glm::length(meshVertices.data[i].pos - meshCenter));
+        }
+
+        if (settings.meshletCulling)
+        {
+            for (MeshLod& lod : lods)
+            {
+                std::vector<Meshlet> lodMeshlets = buildMeshlets(meshIndices.data + lod.firstIndex, lod.indexCount, &meshVertices.data[0].pos.x, sizeof(Vertex), meshVertices.count, MESHLET_MAX_VERTICES, MESHLET_MAX_TRIANGLES);
+                for (Meshlet& meshlet : lodMeshlets)
+                {
+                    meshlet.firstIndex += lod.firstIndex;
+                }
+
+                lod.firstMeshlet = static_cast<uint32_t>(meshlets.size());
+                lod.meshletCount = static_cast<uint32_t>(lodMeshlets.size());
+                meshlets.insert(meshlets.end(), lodMeshlets.begin(), lodMeshlets.end());
+            }
+        }
+
+        const float prepareMs = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - startTime).count();
+        std::cout << "\t" << lods.size() << " levels of detail, " << meshlets.size() << " meshlets, prepared in " << prepareMs << " ms" << std::endl;
+        for (size_t level = 0; level < lods.size(); level++)
+        {
+            std::cout << "\t\tLOD " << level << ": " << lods[level].indexCount / 3 << " triangles, error " << lods[level].error;
+            if (settings.meshletCulling)
+            {
+                std::cout << ", " << lods[level].meshletCount << " meshlets";
+            }
+            std::cout << std::endl;
         }
     }
 
-    void loadModel()
+    void printMeshStatistics(const char* label)
     {
-        tinyobj::attrib_t attrib;
-        std::vector<tinyobj::shape_t> shapes;
-        std::vector<tinyobj::material_t> materials;
-        std::string err;
+        const VertexCacheStatistics cache    = analyzeVertexCache(indices.data(), indices.size(), vertices.size(), VERTEX_CACHE_SIZE);
+        const OverdrawStatistics    overdraw = analyzeOverdraw(indices.data(), indices.size(), &vertices[0].pos.x, sizeof(Vertex), vertices.size());
+        std::cout << "\t" << label << ": ACMR " << cache.acmr << ", ATVR " << cache.atvr << ", overdraw " << overdraw.overdraw << std::endl;
+    }
 
-        if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, MODEL_PATH.c_str()))
+    // Reorders the triangles of the full mesh for the post-transform vertex cache and optionally overdraw
+    void optimizeMesh()
+    {
+        printMeshStatistics("before optimization");
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        std::vector<uint32_t> optimizedIndices(indices.size());
+        std::vector<uint32_t> clusterStarts;
+        optimizeVertexCache(optimizedIndices.data(), indices.data(), indices.size(), vertices.size(), VERTEX_CACHE_SIZE, &clusterStarts);
+        indices.swap(optimizedIndices);
+
+        if (settings.meshOptimization == MeshOptimization::Overdraw)
         {
-            throw std::runtime_error(err);
+            optimizeOverdraw(indices.data(), indices.size(), &vertices[0].pos.x, sizeof(Vertex), vertices.size(), clusterStarts, VERTEX_CACHE_SIZE, 1.05f);
         }
 
-        std::unordered_map<Vertex, uint32_t> uniqueVertices = {};
+        const float optimizeMs = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - startTime).count();
+        printMeshStatistics("after optimization");
+        std::cout << "\toptimized in " << optimizeMs << " ms (" << clusterStarts.size() << " clusters)" << std::endl;
+    }
 
-        for (const auto& shape : shapes)
+    // Builds vertices/indices from the OBJ index stream. The result is identical to inserting every
+    // vertex in stream order into a single hash map: vertices keep the order of their first occurrence.
+    void deduplicateVertices(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::index_t>& objIndices)
+    {
+        const size_t indexCount = objIndices.size();
+        if (indexCount == 0)
+        {
+            return;
+        }
+
+        const size_t chunkCount = std::min(indexCount, threadPool->size() * 4);
+        const size_t shardBits  = 6;
+        const size_t shardCount = size_t(1) << shardBits;
+
+        auto chunkBegin = [&](size_t chunk) { return indexCount * chunk / chunkCount; };
+
+        std::vector<Vertex>                streamVertices(indexCount);
+        std::vector<uint32_t>              firstOccurrence(indexCount);
+        std::vector<std::vector<uint32_t>> shardPositions(chunkCount * shardCount);
+
+        // Build the vertex of every stream position and bucket the positions by shard
+        threadPool->parallelTasks(chunkCount, [&](size_t chunk)
         {
-            for (const auto& index : shape.mesh.indices)
+            for (size_t position = chunkBegin(chunk); position < chunkBegin(chunk + 1); position++)
             {
-                Vertex vertex = {};
+                const tinyobj::index_t& index = objIndices[position];
+                Vertex& vertex                = streamVertices[position];
 
                 vertex.pos = {
                     attrib.vertices[3 * index.vertex_index + 0],
@@ -1623,90 +3392,310 @@ private:
 
                 vertex.color = {1.0f, 1.0f, 1.0f};
 
-                if (uniqueVertices.count(vertex) == 0)
+                const uint64_t hash  = static_cast<uint64_t>(std::hash<Vertex>()(vertex)) * 0x9E3779B97F4A7C15ull;
+                const size_t   shard = static_cast<size_t>(hash >> (64 - shardBits));
+                shardPositions[chunk * shardCount + shard].push_back(static_cast<uint32_t>(position));
+            }
+        });
+
+        // Each shard owns a disjoint set of vertices. Visiting its positions in stream order
+        // records the first stream position every vertex was seen at.
+        threadPool->parallelTasks(shardCount, [&](size_t shard)
+        {
+            std::unordered_map<Vertex, uint32_t> uniqueVertices = {};
+            for (size_t chunk = 0; chunk < chunkCount; chunk++)
+            {
+                for (uint32_t position : shardPositions[chunk * shardCount + shard])
+                {
+                    firstOccurrence[position] = uniqueVertices.try_emplace(streamVertices[position], position).first->second;
+                }
+            }
+        });
+
+        // Number the first occurrences in stream order
+        std::vector<uint32_t> chunkVertexOffset(chunkCount + 1, 0);
+        threadPool->parallelTasks(chunkCount, [&](size_t chunk)
+        {
+            uint32_t count = 0;
+            for (size_t position = chunkBegin(chunk); position < chunkBegin(chunk + 1); position++)
+            {
+                count += firstOccurrence[position] == position;
+            }
+            chunkVertexOffset[chunk + 1] = count;
+        });
+        for (size_t chunk = 0; chunk < chunkCount; chunk++)
+        {
+            chunkVertexOffset[chunk + 1] += chunkVertexOffset[chunk];
+        }
+
+        std::vector<uint32_t> vertexIndex(indexCount);
+        vertices.resize(chunkVertexOffset[chunkCount]);
+        threadPool->parallelTasks(chunkCount, [&](size_t chunk)
+        {
+            uint32_t nextVertex = chunkVertexOffset[chunk];
+            for (size_t position = chunkBegin(chunk); position < chunkBegin(chunk + 1); position++)
+            {
+                if (firstOccurrence[position] == position)
                 {
-                    uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
-                    vertices.push_back(vertex);
+                    vertexIndex[position] = nextVertex;
+                    vertices[nextVertex]  = streamVertices[position];
+                    nextVertex++;
                 }
-                indices.push_back(uniqueVertices[vertex]);
+            }
+        });
 
-                // vertices.push_back(vertex);
-                // indices.push_back(indices.size());
+        indices.resize(indexCount);
+        threadPool->parallelFor(indexCount, [&](size_t begin, size_t end)
+        {
+            for (size_t position = begin; position < end; position++)
+            {
+                indices[position] = vertexIndex[firstOccurrence[position]];
             }
+        });
+    }
+
+    bool supportsVertexFormat(VkFormat format)
+    {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+        return (properties.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT) != 0;
+    }
+
+    void chooseVertexLayout()
+    {
+        vertexLayout = {};
+        auto fullAttributes = Vertex::getAttributeDescriptions();
+        vertexLayout.attributes.assign(fullAttributes.begin(), fullAttributes.end());
+
+        if (!settings.compactVertices || meshVertices.count == 0)
+        {
+            return;
         }
 
-        std::cout << "Loaded model " << MODEL_PATH << " using " << vertices.size() << " vertices" << std::endl;
+        glm::vec3 positionMin = meshVertices.data[0].pos;
+        glm::vec3 positionMax = meshVertices.data[0].pos;
+        bool      hasColor    = false;
+        bool      unormUVs    = true;
+        for (size_t i = 0; i < meshVertices.count; i++)
+        {
+            const Vertex& vertex = meshVertices.data[i];
+            positionMin = glm::min(positionMin, vertex.pos);
+            positionMax = glm::max(positionMax, vertex.pos);
+            hasColor   |= vertex.color != meshVertices.data[0].color;
+            unormUVs   &= vertex.texCoord.x >= 0.0f && vertex.texCoord.x <= 1.0f && vertex.texCoord.y >= 0.0f && vertex.texCoord.y <= 1.0f;
+        }
+
+        const VkFormat positionFormat = VK_FORMAT_R16G16B16A16_UNORM;
+        const VkFormat texCoordFormat = unormUVs ? VK_FORMAT_R16G16_UNORM : VK_FORMAT_R16G16_SFLOAT;
+        const VkFormat colorFormat    = VK_FORMAT_R8G8B8A8_UNORM;
+        if (!supportsVertexFormat(positionFormat) || !supportsVertexFormat(texCoordFormat) || (hasColor && !supportsVertexFormat(colorFormat)))
+        {
+            std::cout << "Compact vertex formats are not supported, using the full vertex layout" << std::endl;
+            return;
+        }
+
+        // Flat axes would divide by zero when quantizing
+        glm::vec3 extent = positionMax - positionMin;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            extent[axis] = extent[axis] > 0.0f ? extent[axis] : 1.0f;
+        }
+
+        vertexLayout.compact        = true;
+        vertexLayout.stride         = hasColor ? 16 : 12;
+        vertexLayout.hasColor       = hasColor;
+        vertexLayout.constantColor  = meshVertices.data[0].color;
+        vertexLayout.positionMin    = positionMin;
+        vertexLayout.positionExtent = extent;
+        vertexLayout.unormTexCoords = unormUVs;
+        vertexLayout.dequantization = glm::scale(glm::translate(glm::mat4(1.0f), positionMin), extent);
+
+        vertexLayout.attributes.clear();
+        vertexLayout.attributes.push_back({0, 0, positionFormat, 0});
+        vertexLayout.attributes.push_back({2, 0, texCoordFormat, 8});
+        if (hasColor)
+        {
+            vertexLayout.attributes.push_back({1, 0, colorFormat, 12});
+        }
+    }
+
+    // Writes the mesh vertices in the compact layout chosen by chooseVertexLayout
+    void packCompactVertices(uint8_t* destination)
+    {
+        auto unorm16 = [](float value)
+        {
+            return static_cast<uint16_t>(std::lround(glm::clamp(value, 0.0f, 1.0f) * 65535.0f));
+        };
+        auto unorm8 = [](float value)
+        {
+            return static_cast<uint8_t>(std::lround(glm::clamp(value, 0.0f, 1.0f) * 255.0f));
+        };
+
+        threadPool->parallelFor(meshVertices.count, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                const Vertex&   vertex     = meshVertices.data[i];
+                uint8_t*        packed     = destination + i * vertexLayout.stride;
+                const glm::vec3 normalized = (vertex.pos - vertexLayout.positionMin) / vertexLayout.positionExtent;
+
+                const uint16_t position[4] = {unorm16(normalized.x), unorm16(normalized.y), unorm16(normalized.z), 0};
+                const uint16_t texCoord[2] = {
+                    vertexLayout.unormTexCoords ? unorm16(vertex.texCoord.x) : glm::packHalf1x16(vertex.texCoord.x),
+                    vertexLayout.unormTexCoords ? unorm16(vertex.texCoord.y) : glm::packHalf1x16(vertex.texCoord.y)
+                };
+                memcpy(packed,     position, sizeof(position));
+                memcpy(packed + 8, texCoord, sizeof(texCoord));
+
+                if (vertexLayout.hasColor)
+                {
+                    const uint8_t color[4] = {unorm8(vertex.color.x), unorm8(vertex.color.y), unorm8(vertex.color.z), 255};
+                    memcpy(packed + 12, color, sizeof(color));
+                }
+            }
+        });
     }
 
     void createVertexBuffer()
     {
-        VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
+        VkDeviceSize bufferSize = vertexLayout.stride * meshVertices.count;
+        vertexBufferSize        = bufferSize;
 
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+        const StagingAllocation staging = stagingRing->allocate(bufferSize);
 
-        void* data;
-        vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-        memcpy(data, vertices.data(), static_cast<size_t>(bufferSize));
-        vkUnmapMemory(device, stagingBufferMemory);
+        void* data = staging.data;
+        if (vertexLayout.compact)
+        {
+            packCompactVertices(static_cast<uint8_t*>(data));
+        }
+        else
+        {
+            memcpy(data, meshVertices.data, static_cast<size_t>(bufferSize));
+        }
 
         createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
 
-        copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
-
-        vkDestroyBuffer(device, stagingBuffer, nullptr);
-        vkFreeMemory(device, stagingBufferMemory, nullptr);
+        copyBuffer(staging, vertexBuffer, bufferSize);
     }
 
     void createIndexBuffer()
     {
-        VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
-
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+        VkDeviceSize bufferSize = meshIndices.byteSize();
 
-        void* data;
-        vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-        memcpy(data, indices.data(), static_cast<size_t>(bufferSize));
-        vkUnmapMemory(device, stagingBufferMemory);
+        const StagingAllocation staging = stagingRing->allocate(bufferSize);
+        memcpy(staging.data, meshIndices.data, static_cast<size_t>(bufferSize));
 
         createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
 
-        copyBuffer(stagingBuffer, indexBuffer, bufferSize);
+        copyBuffer(staging, indexBuffer, bufferSize);
+    }
 
-        vkDestroyBuffer(device, stagingBuffer, nullptr);
-        vkFreeMemory(device, stagingBufferMemory, nullptr);
+    // Instances fill square rings around the origin, so the first N of them always form a compact grid
+    void createInstanceBuffer()
+    {
+        instanceCapacity = settings.instanceSweep ? std::max(settings.instanceCount, INSTANCE_SWEEP.back()) : settings.instanceCount;
+        activeInstanceCount = settings.instanceSweep ? INSTANCE_SWEEP.front() : settings.instanceCount;
+
+        VkDeviceSize bufferSize = sizeof(InstanceData) * instanceCapacity;
+
+        const StagingAllocation staging = stagingRing->allocate(bufferSize);
+        InstanceData* instances = static_cast<InstanceData*>(staging.data);
+
+        const float spacing = INSTANCE_SPACING * meshRadius;
+        uint32_t    written = 0;
+        for (int32_t ring = 0; written < instanceCapacity; ring++)
+        {
+            for (int32_t y = -ring; y <= ring && written < instanceCapacity; y++)
+            {
+                for (int32_t x = -ring; x <= ring && written < instanceCapacity; x++)
+                {
+                    if (std::max(std::abs(x), std::abs(y)) != ring)
+                    {
+                        continue;
+                    }
+
+                    InstanceData instance  = {};
+                    instance.transform     = glm::translate(glm::mat4(1.0f), glm::vec3(x * spacing, y * spacing, 0.0f));
+                    instance.materialIndex = written % INSTANCE_MATERIAL_COUNT;
+                    instances[written++]   = instance;
+                }
+            }
+        }
+
+        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, instanceBuffer, instanceBufferMemory);
+
+        copyBuffer(staging, instanceBuffer, bufferSize);
+    }
+
+    // Distance from the grid center to the farthest corner of the active instances
+    float instanceGridRadius() const
+    {
+        const uint32_t rings = static_cast<uint32_t>(std::ceil((std::sqrt(float(activeInstanceCount)) - 1.0f) * 0.5f));
+        return std::sqrt(2.0f) * rings * INSTANCE_SPACING * meshRadius;
     }
 
+    // One persistently mapped buffer holding a slice per frame in flight, selected with a dynamic offset. Slices
+    // start on whole non coherent atoms so flushing one never touches the slice the device may still read.
     void createUniformBuffer()
     {
-        VkDeviceSize bufferSize = sizeof(UniformBufferObject);
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
 
-        uniformBuffers.resize(swapChainImages.size());
-        uniformBuffersMemory.resize(swapChainImages.size());
+        const VkDeviceSize sliceAlignment = std::max<VkDeviceSize>({1, properties.limits.minUniformBufferOffsetAlignment, properties.limits.nonCoherentAtomSize});
+        uniformSliceSize = (sizeof(UniformBufferObject) + sliceAlignment - 1) / sliceAlignment * sliceAlignment;
 
-        for (size_t i = 0; i < swapChainImages.size(); i++)
+        createBuffer(uniformSliceSize * settings.framesInFlight, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, uniformBuffer, uniformBufferMemory);
+    }
+
+    // One persistently mapped command array per frame in flight, with room for the meshlets of the largest level
+    void createIndirectBuffers()
+    {
+        indirectCommandCapacity = 1;
+        if (settings.meshletCulling)
+        {
+            for (const MeshLod& lod : lods)
+            {
+                indirectCommandCapacity = std::max(indirectCommandCapacity, lod.meshletCount);
+            }
+        }
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        if (multiDrawIndirect && indirectCommandCapacity > properties.limits.maxDrawIndirectCount)
         {
-            createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformBuffers[i], uniformBuffersMemory[i]);
+            multiDrawIndirect = false;
         }
 
+        VkDeviceSize bufferSize = sizeof(VkDrawIndexedIndirectCommand) * indirectCommandCapacity;
+
+        indirectBuffers.resize(settings.framesInFlight);
+        indirectBuffersMemory.resize(settings.framesInFlight);
+        indirectCommands.resize(settings.framesInFlight);
+        indirectCommandCounts.assign(settings.framesInFlight, 0);
+
+        for (size_t i = 0; i < settings.framesInFlight; i++)
+        {
+            createBuffer(bufferSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, indirectBuffers[i], indirectBuffersMemory[i]);
+
+            void* data = indirectBuffersMemory[i].mapped;
+            memset(data, 0, static_cast<size_t>(bufferSize));
+            indirectCommands[i] = static_cast<VkDrawIndexedIndirectCommand*>(data);
+        }
     }
 
     void createDescriptorPool()
     {
         std::array<VkDescriptorPoolSize, 2> poolSizes = {};
-        poolSizes[0].type                             = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        poolSizes[0].descriptorCount                  = static_cast<uint32_t>(swapChainImages.size());
+        poolSizes[0].type                             = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        poolSizes[0].descriptorCount                  = settings.framesInFlight;
         poolSizes[1].type                             = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        poolSizes[1].descriptorCount                  = static_cast<uint32_t>(swapChainImages.size());
+        poolSizes[1].descriptorCount                  = settings.framesInFlight;
 
         VkDescriptorPoolCreateInfo poolInfo           = {};
         poolInfo.sType                                = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
         poolInfo.poolSizeCount                        = static_cast<uint32_t>(poolSizes.size());
         poolInfo.pPoolSizes                           = poolSizes.data();
-        poolInfo.maxSets                              = static_cast<uint32_t>(swapChainImages.size());
+        poolInfo.maxSets                              = settings.framesInFlight;
 
         if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS)
         {
@@ -1714,26 +3703,28 @@ private:
         }
     }
 
+    // One set per frame in flight, so the set of a frame can change once the frame before it in the slot completed
     void createDescriptorSets()
     {
-        std::vector<VkDescriptorSetLayout> layouts(swapChainImages.size(), descriptorSetLayout);
+        std::vector<VkDescriptorSetLayout> layouts(settings.framesInFlight, descriptorSetLayout);
         VkDescriptorSetAllocateInfo allocInfo = {};
         allocInfo.sType                       = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
         allocInfo.descriptorPool              = descriptorPool;
-        allocInfo.descriptorSetCount          = static_cast<uint32_t>(swapChainImages.size());
+        allocInfo.descriptorSetCount          = settings.framesInFlight;
         allocInfo.pSetLayouts                 = layouts.data();
 
-        descriptorSets.resize(swapChainImages.size());
+        descriptorSets.resize(settings.framesInFlight);
+        descriptorSetViews.assign(settings.framesInFlight, textureImageView);
         if (vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()) != VK_SUCCESS)
         {
             throw std::runtime_error("failed to allocate descriptor sets!");
         }
 
-        for (size_t i = 0; i < swapChainImages.size(); i++)
+        for (size_t i = 0; i < descriptorSets.size(); i++)
         {
             VkDescriptorBufferInfo bufferInfo                    = {};
-            bufferInfo.buffer                                    = uniformBuffers[i];
-            bufferInfo.offset                                    = 0;
+            bufferInfo.buffer                                    = uniformBuffer;
+            bufferInfo.offset                                    = 0; // plus the dynamic offset of the frame
             bufferInfo.range                                     = sizeof(UniformBufferObject);
 
             VkDescriptorImageInfo imageInfo                      = {};
@@ -1747,7 +3738,7 @@ private:
             descriptorWrites[0].dstSet                           = descriptorSets[i];
             descriptorWrites[0].dstBinding                       = 0;
             descriptorWrites[0].dstArrayElement                  = 0;
-            descriptorWrites[0].descriptorType                   = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            descriptorWrites[0].descriptorType                   = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
             descriptorWrites[0].descriptorCount                  = 1;
             descriptorWrites[0].pBufferInfo                      = &bufferInfo;
 
@@ -1763,227 +3754,482 @@ private:
         }
     }
 
-    VkCommandBuffer beginSingleTimeCommands()
+    // Points binding 1 of the descriptor set of a frame at the current textureImageView. Only called for the
+    // frame being prepared, whose slot beginFrame() freed, so no frame in flight sees the set change.
+    void updateTextureDescriptor(size_t frame)
     {
-        VkCommandBufferAllocateInfo allocInfo = {};
-        allocInfo.sType                       = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        allocInfo.level                       = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        allocInfo.commandPool                 = commandPool;
-        allocInfo.commandBufferCount          = 1;
-
-        VkCommandBuffer commandBuffer;
-        vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+        if (descriptorSetViews[frame] == textureImageView)
+        {
+            return;
+        }
 
-        VkCommandBufferBeginInfo beginInfo    = {};
-        beginInfo.sType                       = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        beginInfo.flags                       = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VkDescriptorImageInfo imageInfo = {};
+        imageInfo.imageLayout           = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        imageInfo.imageView             = textureImageView;
+        imageInfo.sampler               = textureSampler;
+
+        VkWriteDescriptorSet descriptorWrite = {};
+        descriptorWrite.sType                = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet               = descriptorSets[frame];
+        descriptorWrite.dstBinding           = 1;
+        descriptorWrite.dstArrayElement      = 0;
+        descriptorWrite.descriptorType       = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrite.descriptorCount      = 1;
+        descriptorWrite.pImageInfo           = &imageInfo;
+        vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+        descriptorSetViews[frame] = textureImageView;
+    }
 
-        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    void createStagingRing()
+    {
+        auto submit = [this](const VkSubmitInfo& submitInfo, VkFence fence)
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            return vkQueueSubmit(graphicsQueue, 1, &submitInfo, fence);
+        };
+        stagingRing = std::make_unique<StagingRing>(device, *memoryAllocator, graphicsQueueFamily, STAGING_RING_SIZE, submit);
+    }
 
-        return commandBuffer;
+    void copyBuffer(const StagingAllocation& staging, VkBuffer dstBuffer, VkDeviceSize size)
+    {
+        VkBufferCopy copyRegion = {};
+        copyRegion.srcOffset    = staging.offset;
+        copyRegion.dstOffset    = 0; // Optional
+        copyRegion.size         = size;
+        vkCmdCopyBuffer(stagingRing->commandBuffer(), staging.buffer, dstBuffer, 1, &copyRegion);
     }
 
-    void endSingleTimeCommands(VkCommandBuffer commandBuffer)
-     {
-        vkEndCommandBuffer(commandBuffer);
+    // Every frame in flight gets a command pool per worker thread, so the threads record without locking
+    void createFrameCommandPools()
+    {
+        frameCommandPools.resize(settings.framesInFlight);
+        for (FrameCommandPools& frame : frameCommandPools)
+        {
+            frame.pools.resize(threadPool->size());
+            frame.secondaries.resize(threadPool->size());
+
+            for (size_t i = 0; i < frame.pools.size(); i++)
+            {
+                VkCommandPoolCreateInfo poolInfo = {};
+                poolInfo.sType                   = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+                poolInfo.queueFamilyIndex        = graphicsQueueFamily;
+                poolInfo.flags                   = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
 
-        VkSubmitInfo submitInfo       = {};
-        submitInfo.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers    = &commandBuffer;
+                if (vkCreateCommandPool(device, &poolInfo, nullptr, &frame.pools[i]) != VK_SUCCESS)
+                {
+                    throw std::runtime_error("failed to create frame command pool!");
+                }
 
-        vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-        vkQueueWaitIdle(graphicsQueue);
+                VkCommandBufferAllocateInfo allocInfo = {};
+                allocInfo.sType                       = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+                allocInfo.commandPool                 = frame.pools[i];
+                allocInfo.level                       = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+                allocInfo.commandBufferCount          = 1;
 
-        vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
-    }
+                if (vkAllocateCommandBuffers(device, &allocInfo, &frame.secondaries[i]) != VK_SUCCESS)
+                {
+                    throw std::runtime_error("failed to allocate secondary command buffers!");
+                }
+            }
 
+            VkCommandBufferAllocateInfo allocInfo = {};
+            allocInfo.sType                       = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool                 = frame.pools[0];
+            allocInfo.level                       = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount          = 1;
 
+            if (vkAllocateCommandBuffers(device, &allocInfo, &frame.primary) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to allocate command buffers!");
+            }
+        }
+    }
 
-    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+    // State every draw of the frame depends on, bound again in each secondary command buffer
+    void bindDrawState(VkCommandBuffer commandBuffer)
     {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
 
-        VkBufferCopy copyRegion = {};
-        copyRegion.srcOffset    = 0; // Optional
-        copyRegion.dstOffset    = 0; // Optional
-        copyRegion.size         = size;
-        vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+        VkViewport viewport = {};
+        viewport.width      = static_cast<float>(swapChainExtent.width);
+        viewport.height     = static_cast<float>(swapChainExtent.height);
+        viewport.maxDepth   = 1.0f;
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+        const VkRect2D scissor = {{0, 0}, swapChainExtent};
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+        VkBuffer vertexBuffers[] = {vertexBuffer, instanceBuffer};
+        VkDeviceSize offsets[]   = {0, 0};
+        vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
 
-        endSingleTimeCommands(commandBuffer);
+        vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+
+        const uint32_t dynamicOffset = static_cast<uint32_t>(currentFrame * uniformSliceSize);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentFrame], 1, &dynamicOffset);
     }
 
-    void createCommandBuffers()
+    // Records the frame into the primary command buffer of currentFrame, whose last submission the fence wait in
+    // drawFrame retired, after updateDrawCommands chose the index ranges. The render graph records the passes and
+    // the barriers between them.
+    VkCommandBuffer recordCommandBuffer(uint32_t imageIndex)
     {
-        commandBuffers.resize(swapChainFramebuffers.size());
-        VkCommandBufferAllocateInfo allocInfo = {};
-        allocInfo.sType                       = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        allocInfo.commandPool                 = commandPool;
-        allocInfo.level                       = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        allocInfo.commandBufferCount          = static_cast<uint32_t>(commandBuffers.size());
+        const auto startTime = std::chrono::high_resolution_clock::now();
 
-        if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS)
+        FrameCommandPools& frame = frameCommandPools[currentFrame];
+        for (VkCommandPool pool : frame.pools)
         {
-            throw std::runtime_error("failed to allocate command buffers!");
+            vkResetCommandPool(device, pool, 0);
         }
 
-        for (size_t i = 0; i < commandBuffers.size(); i++)
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType                    = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags                    = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        if (vkBeginCommandBuffer(frame.primary, &beginInfo) != VK_SUCCESS)
         {
-            VkCommandBufferBeginInfo beginInfo = {};
-            beginInfo.sType                    = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-            beginInfo.flags                    = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-            beginInfo.pInheritanceInfo         = nullptr; // Optional
+            throw std::runtime_error("failed to begin recording command buffer!");
+        }
 
-            if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) != VK_SUCCESS)
-            {
-                throw std::runtime_error("failed to begin recording command buffer!");
-            }
+        renderGraph->execute(frame.primary, imageIndex);
 
-            std::array<VkClearValue, 2> clearValues = {};
-            clearValues[0].color                    = {0.0f, 0.0f, 0.0f, 1.0f};
-            clearValues[1].depthStencil             = {1.0f, 0};
+        if (vkEndCommandBuffer(frame.primary) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to record command buffer!");
+        }
 
-            VkRenderPassBeginInfo renderPassInfo    = {};
-            renderPassInfo.sType                    = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-            renderPassInfo.renderPass               = renderPass;
-            renderPassInfo.framebuffer              = swapChainFramebuffers[i];
-            renderPassInfo.renderArea.offset        = {0, 0};
-            renderPassInfo.renderArea.extent        = swapChainExtent;
-            renderPassInfo.clearValueCount          = static_cast<uint32_t>(clearValues.size());
-            renderPassInfo.pClearValues             = clearValues.data();
+        drawStatistics.recordMs = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - startTime).count();
+        return frame.primary;
+    }
 
-            vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-            vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+    // The draws of the scene pass, inline indirect draws or secondary command buffers with one direct draw each
+    void recordScenePass(const RenderGraphContext& context)
+    {
+        if (settings.drawSubmission == DrawSubmission::Direct)
+        {
+            FrameCommandPools& frame = frameCommandPools[currentFrame];
+            recordDirectDraws(frame, context);
+            vkCmdExecuteCommands(context.commandBuffer, static_cast<uint32_t>(frame.secondaries.size()), frame.secondaries.data());
+            return;
+        }
 
-            VkBuffer vertexBuffers[] = {vertexBuffer};
-            VkDeviceSize offsets[]   = {0};
-            vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
+        bindDrawState(context.commandBuffer);
 
-            vkCmdBindIndexBuffer(commandBuffers[i], indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+        const uint32_t commandStride = sizeof(VkDrawIndexedIndirectCommand);
+        if (multiDrawIndirect || indirectCommandCapacity == 1)
+        {
+            vkCmdDrawIndexedIndirect(context.commandBuffer, indirectBuffers[currentFrame], 0, indirectCommandCapacity, commandStride);
+            drawStatistics.recordedDraws = 1;
+        }
+        else
+        {
+            for (uint32_t command = 0; command < indirectCommandCapacity; command++)
+            {
+                vkCmdDrawIndexedIndirect(context.commandBuffer, indirectBuffers[currentFrame], command * commandStride, 1, commandStride);
+            }
+            drawStatistics.recordedDraws = indirectCommandCapacity;
+        }
+    }
 
-            vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[i], 0, nullptr);
+    // Expands the index ranges of the frame into one draw per range and instance and splits them evenly over the
+    // secondary command buffers, each recorded by one task from its own pool
+    void recordDirectDraws(FrameCommandPools& frame, const RenderGraphContext& context)
+    {
+        const VkDrawIndexedIndirectCommand*             commands = indirectCommands[currentFrame];
+        const std::vector<VkDrawIndexedIndirectCommand> ranges(commands, commands + indirectCommandCounts[currentFrame]);
+        const size_t                                    drawCount   = ranges.size() * activeInstanceCount;
+        const size_t                                    threadCount = frame.secondaries.size();
+
+        VkCommandBufferInheritanceInfo inheritanceInfo = {};
+        inheritanceInfo.sType                          = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        inheritanceInfo.renderPass                     = context.renderPass;
+        inheritanceInfo.subpass                        = 0;
+        inheritanceInfo.framebuffer                    = context.framebuffer;
+
+        threadPool->parallelTasks(threadCount, [&](size_t thread)
+        {
+            const VkCommandBuffer commandBuffer = frame.secondaries[thread];
 
-            vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+            VkCommandBufferBeginInfo beginInfo = {};
+            beginInfo.sType                    = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags                    = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+            beginInfo.pInheritanceInfo         = &inheritanceInfo;
 
+            if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to begin recording secondary command buffer!");
+            }
 
-            vkCmdEndRenderPass(commandBuffers[i]);
+            bindDrawState(commandBuffer);
+            for (size_t draw = drawCount * thread / threadCount; draw < drawCount * (thread + 1) / threadCount; draw++)
+            {
+                const VkDrawIndexedIndirectCommand& range = ranges[draw % ranges.size()];
+                vkCmdDrawIndexed(commandBuffer, range.indexCount, 1, range.firstIndex, range.vertexOffset, static_cast<uint32_t>(draw / ranges.size()));
+            }
 
-            if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS)
+            if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
             {
-                throw std::runtime_error("failed to record command buffer!");
+                throw std::runtime_error("failed to record secondary command buffer!");
             }
-        }
+        });
+
+        drawStatistics.recordedDraws = static_cast<uint32_t>(drawCount);
     }
 
     void createSyncObjects()
     {
-        imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-        renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-        inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+        imageAvailableSemaphores.resize(settings.framesInFlight);
+        renderFinishedSemaphores.resize(settings.framesInFlight);
+        frameUploadSemaphores.resize(settings.framesInFlight);
+        frameAcquireCommandBuffers.resize(settings.framesInFlight);
 
         VkSemaphoreCreateInfo semaphoreInfo = {};
         semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-        VkFenceCreateInfo fenceInfo = {};
-        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-        fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        for (size_t i = 0; i < settings.framesInFlight; i++)
         {
             if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS ||
-                vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS ||
-                vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS)
+                vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS)
             {
 
                 throw std::runtime_error("failed to create semaphores for a frame!");
             }
         }
+
+        frameScheduler = std::make_unique<FrameScheduler>(device, settings.framesInFlight, timelineSemaphores, FRAME_TIMEOUT_NS);
+        std::cout << "Frame pacing: " << frameScheduler->framesInFlight() << " frames in flight, "
+                  << (frameScheduler->usesTimeline() ? "timeline semaphore" : "fences") << (settings.lowLatency ? ", low latency" : "") << std::endl;
     }
 
     void drawFrame()
     {
-        vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
+        // An occluded or minimized window may hold back its images for a long time
+        const std::optional<uint32_t> frameSlot = frameScheduler->beginFrame();
+        if (!frameSlot)
+        {
+            return;
+        }
+        currentFrame = *frameSlot;
+        releaseFrameUploads(currentFrame);
+        adoptReloadedPipeline();
 
         uint32_t imageIndex;
-        VkResult result = vkAcquireNextImageKHR(device, swapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+        VkResult result = vkAcquireNextImageKHR(device, swapChain, FRAME_TIMEOUT_NS, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
 
         if (result == VK_ERROR_OUT_OF_DATE_KHR)
         {
             recreateSwapChain();
             return;
         }
+        else if (result == VK_TIMEOUT || result == VK_NOT_READY)
+        {
+            return;
+        }
         else if(result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
         {
             throw std::runtime_error("failed to acquire swap chain image!");
         }
 
-        VkSemaphore waitSemaphores[]      = {imageAvailableSemaphores[currentFrame]};
-        VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-        VkSemaphore signalSemaphores[]    = {renderFinishedSemaphores[currentFrame]};
+        std::vector<VkSemaphore>          waitSemaphores   = {imageAvailableSemaphores[currentFrame]};
+        std::vector<VkPipelineStageFlags> waitStages       = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+        std::vector<VkCommandBuffer>      submitBuffers;
+        std::vector<VkSemaphore>          signalSemaphores = {renderFinishedSemaphores[currentFrame]};
+
+        acquireStreamedTextureLevels(waitSemaphores, waitStages, submitBuffers);
+        updateTextureDescriptor(currentFrame);
+
+        // Everything that blocks is behind us, so what the frame shows is sampled right before it is submitted
+        if (settings.lowLatency)
+        {
+            frameScheduler->waitForSubmittedFrames(); // the image is acquired, so a timeout only costs latency
+            glfwPollEvents();
+        }
+        updateUniformBuffer();
+        submitBuffers.push_back(recordCommandBuffer(imageIndex));
 
-        updateUniformBuffer(imageIndex);
+        // Uploads queued since the last frame run ahead of it on the same queue
+        stagingRing->flush();
 
         VkSubmitInfo submitInfo           = {};
         submitInfo.sType                  = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.waitSemaphoreCount     = 1;
-        submitInfo.pWaitSemaphores        = waitSemaphores;
-        submitInfo.pWaitDstStageMask      = waitStages;
-        submitInfo.commandBufferCount     = 1;
-        submitInfo.pCommandBuffers        = &commandBuffers[imageIndex];
-        submitInfo.signalSemaphoreCount   = 1;
-        submitInfo.pSignalSemaphores      = signalSemaphores;
-
-        vkResetFences(device, 1, &inFlightFences[currentFrame]);
-        if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS)
+        submitInfo.waitSemaphoreCount     = static_cast<uint32_t>(waitSemaphores.size());
+        submitInfo.pWaitSemaphores        = waitSemaphores.data();
+        submitInfo.pWaitDstStageMask      = waitStages.data();
+        submitInfo.commandBufferCount     = static_cast<uint32_t>(submitBuffers.size());
+        submitInfo.pCommandBuffers        = submitBuffers.data();
+
+        const VkFence frameFence          = frameScheduler->prepareSubmit(submitInfo, signalSemaphores);
+        submitInfo.signalSemaphoreCount   = static_cast<uint32_t>(signalSemaphores.size());
+        submitInfo.pSignalSemaphores      = signalSemaphores.data();
         {
-            throw std::runtime_error("failed to submit draw command buffer!");
+            std::lock_guard<std::mutex> lock(queueMutex);
+            if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, frameFence) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to submit draw command buffer!");
+            }
         }
+        frameScheduler->endFrame();
 
         VkSwapchainKHR swapChains[]       = {swapChain};
         VkPresentInfoKHR presentInfo      = {};
         presentInfo.sType                 = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
         presentInfo.waitSemaphoreCount    = 1;
-        presentInfo.pWaitSemaphores       = signalSemaphores;
+        presentInfo.pWaitSemaphores       = &signalSemaphores[0];
         presentInfo.swapchainCount        = 1;
         presentInfo.pSwapchains           = swapChains;
         presentInfo.pImageIndices         = &imageIndex;
         presentInfo.pResults              = nullptr; // Optional
 
-        result = vkQueuePresentKHR(presentQueue, &presentInfo);
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            result = vkQueuePresentKHR(presentQueue, &presentInfo);
+        }
 
-        if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized)
+        if (!firstFramePresented)
         {
-            framebufferResized = false;
-            recreateSwapChain();
+            firstFramePresented = true;
+            const float firstFrameMs = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - launchTime).count();
+            std::cout << "First frame after " << firstFrameMs << " ms" << std::endl;
         }
-        else if (result != VK_SUCCESS)
+
+        if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR && result != VK_ERROR_OUT_OF_DATE_KHR)
         {
             throw std::runtime_error("failed to present swap chain image!");
         }
 
-
-        currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+        // Dragging a window edge reports a new size every few milliseconds. A suboptimal swap chain still presents,
+        // so it is kept until the burst settled, only an out of date one has to be replaced right away.
+        framebufferResized = framebufferResized || result == VK_SUBOPTIMAL_KHR;
+        const float sinceResizeMs = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - lastResizeEvent).count();
+        if (result == VK_ERROR_OUT_OF_DATE_KHR || (framebufferResized && sinceResizeMs >= RESIZE_SETTLE_MS))
+        {
+            recreateSwapChain();
+        }
     }
 
-    void updateUniformBuffer(uint32_t currentImage)
+    // Writes the slice of currentFrame, which the fence wait in drawFrame freed
+    void updateUniformBuffer()
     {
         static auto startTime = std::chrono::high_resolution_clock::now();
 
         auto currentTime = std::chrono::high_resolution_clock::now();
         float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
 
+        const glm::mat4 rotation = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+
+        // Pull the camera back far enough to see every instance
+        const float gridRadius = instanceGridRadius();
+        const float viewScale  = meshRadius > 0.0f ? 1.0f + gridRadius / meshRadius : 1.0f;
+
         UniformBufferObject ubo = {};
-        ubo.model       = glm::rotate(     glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-        ubo.view        = glm::lookAt(     glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-        ubo.proj        = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float) swapChainExtent.height, 0.1f, 10.0f);
+        ubo.model       = rotation * vertexLayout.dequantization;
+        ubo.view        = glm::lookAt(     glm::vec3(2.0f, 2.0f, 2.0f) * viewScale, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+        ubo.proj        = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float) swapChainExtent.height, 0.1f * viewScale, 10.0f * viewScale);
         ubo.proj[1][1] *= -1;
 
-        void* data;
-        vkMapMemory(device, uniformBuffersMemory[currentImage], 0, sizeof(ubo), 0, &data);
-        memcpy(data, &ubo, sizeof(ubo));
-        vkUnmapMemory(device, uniformBuffersMemory[currentImage]);
+        const VkDeviceSize sliceOffset = currentFrame * uniformSliceSize;
+        memcpy(static_cast<uint8_t*>(uniformBufferMemory.mapped) + sliceOffset, &ubo, sizeof(ubo));
+        memoryAllocator->flush(uniformBufferMemory, sliceOffset, sizeof(ubo));
+
+        // Bounds and simplification errors are in mesh space, before dequantization
+        const glm::mat4 modelView = ubo.view * rotation;
+        updateDrawCommands(ubo.proj, modelView, gridRadius);
+    }
+
+    // Picks the coarsest level whose error projects to at most lodThreshold pixels at the near side of the mesh bounds
+    uint32_t selectLod(const glm::mat4& projection, const glm::vec3& cameraPosition, float boundsRadius)
+    {
+        const float distance      = std::max(glm::length(meshCenter - cameraPosition) - boundsRadius, 1e-3f);
+        const float pixelsPerUnit = std::abs(projection[1][1]) * 0.5f * swapChainExtent.height / distance;
+
+        uint32_t lod = 0;
+        for (uint32_t level = 1; level < lods.size(); level++)
+        {
+            if (lods[level].error * pixelsPerUnit <= settings.lodThreshold)
+            {
+                lod = level;
+            }
+        }
+        return lod;
+    }
+
+    // Writes the index ranges of this frame, the unused tail as empty draws. With culling only the visible
+    // meshlets of the selected level are drawn, merged into contiguous ranges. Culling works in the space of
+    // a single mesh, so several instances draw the whole level instead.
+    void updateDrawCommands(const glm::mat4& projection, const glm::mat4& modelView, float gridRadius)
+    {
+        const glm::vec3 cameraPosition = glm::vec3(glm::inverse(modelView)[3]);
+
+        DrawStatistics statistics;
+        statistics.lod       = selectLod(projection, cameraPosition, meshRadius + gridRadius);
+        statistics.instances = activeInstanceCount;
+        const MeshLod& lod   = lods[statistics.lod];
+
+        VkDrawIndexedIndirectCommand* commands = indirectCommands[currentFrame];
+        if (!settings.meshletCulling || activeInstanceCount > 1)
+        {
+            commands[0]               = {};
+            commands[0].indexCount    = lod.indexCount;
+            commands[0].instanceCount = activeInstanceCount;
+            commands[0].firstIndex    = lod.firstIndex;
+            if (indirectCommandCounts[currentFrame] > 1)
+            {
+                memset(&commands[1], 0, (indirectCommandCounts[currentFrame] - 1) * sizeof(VkDrawIndexedIndirectCommand));
+            }
+            indirectCommandCounts[currentFrame] = 1;
+
+            statistics.triangles    = uint64_t(lod.indexCount / 3) * activeInstanceCount;
+            statistics.drawCommands = 1;
+            drawStatistics          = statistics;
+            return;
+        }
+
+        const Frustum frustum = extractFrustum(projection * modelView);
+        for (uint32_t m = lod.firstMeshlet; m < lod.firstMeshlet + lod.meshletCount; m++)
+        {
+            const Meshlet& meshlet = meshlets[m];
+            if (!isSphereInFrustum(frustum, meshlet.center, meshlet.radius))
+            {
+                statistics.frustumCulled++;
+                continue;
+            }
+            if (isMeshletBackfacing(meshlet, cameraPosition))
+            {
+                statistics.backfaceCulled++;
+                continue;
+            }
+
+            statistics.visible++;
+            statistics.triangles += meshlet.indexCount / 3;
+            VkDrawIndexedIndirectCommand* previous = statistics.drawCommands > 0 ? &commands[statistics.drawCommands - 1] : nullptr;
+            if (previous && previous->firstIndex + previous->indexCount == meshlet.firstIndex)
+            {
+                previous->indexCount += meshlet.indexCount;
+                continue;
+            }
+
+            VkDrawIndexedIndirectCommand& command = commands[statistics.drawCommands++];
+            command.indexCount                    = meshlet.indexCount;
+            command.instanceCount                 = 1;
+            command.firstIndex                    = meshlet.firstIndex;
+            command.vertexOffset                  = 0;
+            command.firstInstance                 = 0;
+        }
+
+        if (statistics.drawCommands < indirectCommandCounts[currentFrame])
+        {
+            memset(&commands[statistics.drawCommands], 0, (indirectCommandCounts[currentFrame] - statistics.drawCommands) * sizeof(VkDrawIndexedIndirectCommand));
+        }
+        indirectCommandCounts[currentFrame] = statistics.drawCommands;
+        drawStatistics                      = statistics;
     }
 
+    Settings                     settings;
+    std::unique_ptr<ThreadPool>  threadPool;
+    std::unique_ptr<DeviceAllocator> memoryAllocator;
+    std::unique_ptr<StagingRing> stagingRing; // uploads from the main thread, flushed once per frame
+    std::chrono::high_resolution_clock::time_point launchTime;
+    bool                         firstFramePresented = false;
     GLFWwindow*                  window         = nullptr;
     VkInstance                   instance;
     VkDebugReportCallbackEXT     callback;
@@ -1992,50 +4238,102 @@ private:
     VkDevice                     device;
     VkQueue                      graphicsQueue;
     VkQueue                      presentQueue;
-    VkSwapchainKHR               swapChain;
+    VkQueue                      transferQueue;
+    uint32_t                     graphicsQueueFamily = 0;
+    uint32_t                     transferQueueFamily = 0;
+    std::mutex                   queueMutex; // queues are externally synchronized and the texture streamer submits too
+    VkSwapchainKHR               swapChain = VK_NULL_HANDLE;
     std::vector<VkImage>         swapChainImages;
     VkFormat                     swapChainImageFormat;
     VkExtent2D                   swapChainExtent;
+    VkExtent2D                   framebufferExtent  = {}; // of the window, from queryFramebufferExtent()
     std::vector<VkImageView>     swapChainImageViews;
-    VkRenderPass                 renderPass;
+    std::unique_ptr<RenderGraph> renderGraph;
+    uint32_t                     scenePass          = 0;
+    uint32_t                     swapChainImport    = 0; // render graph image of the swap chain
     VkDescriptorSetLayout        descriptorSetLayout;
     VkPipelineLayout             pipelineLayout;
     VkPipeline                   graphicsPipeline;
-    std::vector<VkFramebuffer>   swapChainFramebuffers;
+    std::unordered_map<std::string, std::vector<char>> shaderCode; // SPIR-V by source name
+    ShaderCompiler               shaderCompiler;
+    std::unique_ptr<ShaderWatcher> shaderWatcher;
+    std::mutex                   pipelineMutex;    // the render graph, pipeline layout and shader code the watcher thread builds pipelines from
+    VkPipeline                   reloadedPipeline = VK_NULL_HANDLE; // built by the watcher thread, not yet swapped in
+    VkPipelineCache              pipelineCache         = VK_NULL_HANDLE; // shared by every pipeline creation
+    bool                         pipelineCacheWarm     = false; // holds data from disk or an earlier creation
+    float                        pipelineColdCompileMs = 0.0f;  // 0 if never measured
     VkCommandPool                commandPool;
-    std::vector<VkCommandBuffer> commandBuffers;
+    std::vector<FrameCommandPools> frameCommandPools;
     std::vector<VkSemaphore>     imageAvailableSemaphores;
     std::vector<VkSemaphore>     renderFinishedSemaphores;
-    std::vector<VkFence>         inFlightFences;
+    std::unique_ptr<FrameScheduler> frameScheduler;
     size_t                       currentFrame       = 0;
-    bool                         framebufferResized = false;
+    bool                         framebufferResized = false; // recreation pending until the resize events settle
+    uint32_t                     resizeEvents       = 0;     // since the last recreation
+    std::chrono::high_resolution_clock::time_point lastResizeEvent;
+    std::vector<float>           frameTimes;
+    std::vector<float>           frameLatencies;
+    std::vector<DrawStatistics>  frameDrawStatistics;
+    std::vector<BenchmarkResult> sweepResults;
     std::vector<Vertex>          vertices;
     std::vector<uint32_t>        indices;
+    MappedFile                   meshCacheFile;
+    ArrayView<Vertex>            meshVertices;
+    ArrayView<uint32_t>          meshIndices;
+    VertexLayout                 vertexLayout;
     VkBuffer                     vertexBuffer;
-    VkDeviceMemory               vertexBufferMemory;
+    VkDeviceSize                 vertexBufferSize   = 0;
+    DeviceAllocation             vertexBufferMemory;
     VkBuffer                     indexBuffer;
-    VkDeviceMemory               indexBufferMemory;
-    std::vector<VkBuffer>        uniformBuffers;
-    std::vector<VkDeviceMemory>  uniformBuffersMemory;
+    DeviceAllocation             indexBufferMemory;
+    VkBuffer                     instanceBuffer;
+    DeviceAllocation             instanceBufferMemory;
+    uint32_t                     instanceCapacity    = 1;
+    uint32_t                     activeInstanceCount = 1;
+    std::vector<MeshLod>         lods;
+    glm::vec3                    meshCenter         = glm::vec3(0.0f);
+    float                        meshRadius         = 0.0f;
+    std::vector<Meshlet>         meshlets;
+    DrawStatistics               drawStatistics;
+    bool                         multiDrawIndirect  = false;
+    bool                         textureCompressionBC = false;
+    bool                         physicalDeviceProperties2 = false;
+    bool                         timelineSemaphores   = false;
+    std::vector<VkBuffer>        indirectBuffers;
+    std::vector<DeviceAllocation> indirectBuffersMemory;
+    std::vector<VkDrawIndexedIndirectCommand*> indirectCommands;
+    std::vector<uint32_t>        indirectCommandCounts;
+    uint32_t                     indirectCommandCapacity = 1;
+    VkBuffer                     uniformBuffer;
+    DeviceAllocation             uniformBufferMemory;
+    VkDeviceSize                 uniformSliceSize   = 0; // one slice per frame in flight
     VkDescriptorPool             descriptorPool;
-    std::vector<VkDescriptorSet> descriptorSets;
+    std::vector<VkDescriptorSet> descriptorSets;     // one per frame in flight
+    std::vector<VkImageView>     descriptorSetViews; // texture view each set samples
     uint32_t                     mipLevels;
+    std::unique_ptr<TextureSource> textureSource; // from loadTextureSource until createTextureImage
     VkImage                      textureImage;
-    VkDeviceMemory               textureImageMemory;
+    VkFormat                     textureImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+    DeviceAllocation             textureImageMemory;
     VkImageView                  textureImageView;
     VkSampler                    textureSampler;
-    VkImage                      depthImage;
-    VkDeviceMemory               depthImageMemory;
-    VkImageView                  depthImageView;
+    std::thread                  textureStreamer;
+    std::atomic<bool>            stopTextureStreaming{false};
+    std::mutex                   streamedLevelsMutex;
+    std::vector<StreamedTextureLevels> streamedLevels;   // finished by the streamer, not yet picked up by drawFrame
+    uint32_t                     residentTextureLevel = 0; // finest level the descriptors sample
+    std::vector<VkImageView>     textureLevelViews;       // levels k and up
+    VkImage                      placeholderImage       = VK_NULL_HANDLE;
+    DeviceAllocation             placeholderImageMemory;
+    VkImageView                  placeholderImageView   = VK_NULL_HANDLE;
+    std::vector<std::vector<VkSemaphore>>     frameUploadSemaphores;
+    std::vector<std::vector<VkCommandBuffer>> frameAcquireCommandBuffers;
     VkSampleCountFlagBits        msaaSamples = VK_SAMPLE_COUNT_1_BIT;
-    VkImage                      colorImage;
-    VkDeviceMemory               colorImageMemory;
-    VkImageView                  colorImageView;
 };
 
-int main()
+int main(int argc, char** argv)
 {
-    HelloTriangleApplication app;
+    HelloTriangleApplication app(parseArguments(argc, argv));
 
     try
     {